@@ -13,12 +13,39 @@ plt.rcParams['figure.figsize'] = (24, 12)
 plt.rcParams['lines.linewidth'] = 2.0
 plt.rcParams['font.size'] = 10
 
+def read_trace_bin(filename):
+    # Định dạng binary dạng cột của mode1.cc (--traceFormat=bin)
+    with open(filename, 'rb') as f:
+        data = f.read()
+    assert data[:8] == b'UAVTRACE'
+    _, ncols = np.frombuffer(data, dtype='<u4', count=2, offset=8)
+    pos = 16
+    cols = []
+    for _ in range(ncols):
+        kind, size = chr(data[pos]), data[pos + 1]
+        nlen = int(np.frombuffer(data, dtype='<u2', count=1, offset=pos + 2)[0])
+        cols.append((data[pos + 4:pos + 4 + nlen].decode(), np.dtype(f'<{kind}{size}')))
+        pos += 4 + nlen
+    chunks = {name: [] for name, _ in cols}
+    while pos < len(data):
+        nrows = int(np.frombuffer(data, dtype='<u4', count=1, offset=pos)[0])
+        pos += 4
+        for name, dt in cols:
+            chunks[name].append(np.frombuffer(data, dtype=dt, count=nrows, offset=pos))
+            pos += nrows * dt.itemsize
+    return pd.DataFrame({name: np.concatenate(c) if c else np.array([], dtype=dt)
+                         for (name, dt), c in zip(cols, chunks.values())})
+
 def safe_read_csv(filename):
     try:
         return pd.read_csv(filename)
     except FileNotFoundError:
-        print(f"⚠️ Lỗi: Không tìm thấy file {filename}")
-        return None
+        bin_name = filename.rsplit('.', 1)[0] + '.bin'
+        try:
+            return read_trace_bin(bin_name)
+        except FileNotFoundError:
+            print(f"⚠️ Lỗi: Không tìm thấy file {filename}")
+            return None
 
 # === LOAD TẤT CẢ DỮ LIỆU ===
 df_thpt = safe_read_csv('scenario1_final_throughput.csv')
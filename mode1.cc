@@ -8,301 +8,3457 @@
 #include "ns3/flow-monitor-module.h"
 #include "ns3/buildings-module.h"
 #include "ns3/netanim-module.h" 
+#include "ns3/propagation-module.h"
 #include <fstream>
 #include <map>
+#include <unordered_map>
 #include <deque>
 #include <string>
 #include <iomanip>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <functional>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <sstream>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <unistd.h>
 
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("ScenarioUavMecAdvanced");
 
+// ==================== SELF PROFILER ====================
+// Bật bằng --profile. Mỗi callback / hàm được schedule có một PROFILE_SCOPE: đếm số lần gọi,
+// thời gian wall inclusive và exclusive (trừ phần của scope con). Thời gian Run() còn lại
+// ngoài mọi scope là của ns-3 (LTE PHY/MAC, spectrum, EPC, FlowMonitor, NetAnim).
+// Khi tắt, mỗi scope chỉ tốn một phép kiểm tra bool.
+class SelfProfiler {
+public:
+    static SelfProfiler& Get() { static SelfProfiler instance; return instance; }
+
+    uint32_t Register(const char* name) { m_components.push_back({name, 0, 0.0, 0.0}); return m_components.size() - 1; }
+    void Enable(bool on) { m_enabled = on; }
+    bool Enabled() const { return m_enabled; }
+
+    void Enter(uint32_t id) {
+        if (m_depth < kMaxDepth) m_stack[m_depth] = {id, Clock::now(), 0.0};
+        m_depth++;
+    }
+    void Exit() {
+        if (--m_depth >= kMaxDepth) return;
+        Frame& f = m_stack[m_depth];
+        double elapsed = std::chrono::duration<double>(Clock::now() - f.start).count();
+        Component& c = m_components[f.id];
+        c.calls++; c.inclusive += elapsed; c.exclusive += elapsed - f.child;
+        if (m_depth > 0) m_stack[m_depth - 1].child += elapsed;
+    }
+
+    // Mốc đầu của Run(); các mẫu timeline tính events/s trên khoảng giữa 2 mẫu
+    void BeginRun() {
+        m_runStart = Clock::now();
+        m_timeline.clear();
+        m_timeline.push_back({Simulator::Now().GetSeconds(), 0.0, Simulator::GetEventCount(), CurrentRssMB()});
+    }
+    void Sample() {
+        m_timeline.push_back({Simulator::Now().GetSeconds(), std::chrono::duration<double>(Clock::now() - m_runStart).count(),
+                              Simulator::GetEventCount(), CurrentRssMB()});
+    }
+    void SetPhases(double setup, double run, double teardown) { m_setup = setup; m_run = run; m_teardown = teardown; }
+
+    void Dump(std::ostream& os, const std::string& prefix) const {
+        std::vector<const Component*> sorted;
+        double instrumented = 0.0;
+        for (const Component& c : m_components) if (c.calls) { sorted.push_back(&c); instrumented += c.exclusive; }
+        std::sort(sorted.begin(), sorted.end(), [](const Component* a, const Component* b) { return a->exclusive > b->exclusive; });
+        double other = std::max(0.0, m_run - instrumented);
+        uint64_t events = m_timeline.empty() ? 0 : m_timeline.back().events - m_timeline.front().events;
+
+        std::ofstream out(prefix + "profile.csv");
+        out << "Component,Calls,Exclusive(s),Inclusive(s),RunShare(%),ExclusivePerCall(us)\n";
+        os << "\n=== PROFILE ===" << std::endl;
+        os << "Phases: setup " << m_setup << "s | run " << m_run << "s | teardown " << m_teardown << "s" << std::endl;
+        os << "Events: " << events << " (" << (m_run > 0 ? events / m_run : 0.0) << " /s wall) | peak RSS "
+           << PeakRssMB() << " MB" << std::endl;
+        for (const Component* c : sorted) {
+            double share = m_run > 0 ? c->exclusive / m_run * 100.0 : 0.0;
+            out << c->name << "," << c->calls << "," << c->exclusive << "," << c->inclusive << "," << share << ","
+                << c->exclusive / c->calls * 1e6 << "\n";
+            os << "  " << std::left << std::setw(28) << c->name << std::right << std::setw(12) << c->calls << " calls "
+               << std::setw(10) << c->exclusive << " s " << std::setw(6) << share << " %" << std::endl;
+        }
+        out << "ns-3 internals,0," << other << "," << other << "," << (m_run > 0 ? other / m_run * 100.0 : 0.0) << ",0\n";
+        os << "  " << std::left << std::setw(28) << "ns-3 internals" << std::right << std::setw(12) << "-" << " calls "
+           << std::setw(10) << other << " s " << std::setw(6) << (m_run > 0 ? other / m_run * 100.0 : 0.0) << " %" << std::endl;
+
+        std::ofstream timeline(prefix + "profile_timeline.csv");
+        timeline << "SimTime,WallTime,Events,EventsPerSec,SimSpeed,RssMB\n";
+        for (size_t i = 1; i < m_timeline.size(); ++i) {
+            const Mark& a = m_timeline[i - 1]; const Mark& b = m_timeline[i];
+            double wall = b.wall - a.wall;
+            timeline << b.sim << "," << b.wall << "," << b.events << "," << (wall > 0 ? (b.events - a.events) / wall : 0.0) << ","
+                     << (wall > 0 ? (b.sim - a.sim) / wall : 0.0) << "," << b.rssMB << "\n";
+        }
+    }
+
+    static double PeakRssMB() {
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024.0;   // Linux: KB
+    }
+    static double CurrentRssMB() {
+        long pages = 0, resident = 0;
+        std::FILE* f = std::fopen("/proc/self/statm", "r");
+        if (!f) return 0.0;
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        std::fclose(f);
+        return resident * (double)::sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const uint32_t kMaxDepth = 32;
+    struct Component { const char* name; uint64_t calls; double inclusive, exclusive; };
+    struct Frame { uint32_t id; Clock::time_point start; double child; };
+    struct Mark { double sim, wall; uint64_t events; double rssMB; };
+
+    bool m_enabled = false;
+    std::vector<Component> m_components;
+    Frame m_stack[kMaxDepth];
+    uint32_t m_depth = 0;
+    Clock::time_point m_runStart;
+    std::vector<Mark> m_timeline;
+    double m_setup = 0.0, m_run = 0.0, m_teardown = 0.0;
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(uint32_t id) : m_on(SelfProfiler::Get().Enabled()) { if (m_on) SelfProfiler::Get().Enter(id); }
+    ~ProfileScope() { if (m_on) SelfProfiler::Get().Exit(); }
+private:
+    bool m_on;
+};
+
+#define PROFILE_SCOPE(name) \
+    static const uint32_t profileId_ = SelfProfiler::Get().Register(name); \
+    ProfileScope profileScope_(profileId_)
+
+// ==================== TRACE SINK ====================
+// Các callback chỉ đẩy record vào buffer RAM; khi đủ một batch thì chuyển cho
+// writer thread ghi ra đĩa. Không còn flush mỗi dòng (std::endl) trong trace callback.
+enum class TraceFormat { CSV, BINARY };
+
+// Visitor ghi schema của file binary: mỗi cột = (kiểu, kích thước, tên)
+class ColumnSchemaWriter {
+public:
+    explicit ColumnSchemaWriter(std::ostream& os) : m_os(os) {}
+    template <typename R, typename T>
+    void operator()(const char* name, T R::*) {
+        char type = std::is_floating_point<T>::value ? 'f' : (std::is_signed<T>::value ? 'i' : 'u');
+        uint8_t size = sizeof(T);
+        uint16_t len = std::char_traits<char>::length(name);
+        m_os.write(&type, 1);
+        m_os.write(reinterpret_cast<const char*>(&size), 1);
+        m_os.write(reinterpret_cast<const char*>(&len), 2);
+        m_os.write(name, len);
+    }
+    std::ostream& m_os;
+};
+
+// Visitor ghi một batch theo dạng cột: mỗi cột là một mảng liên tục nrows phần tử
+template <typename R>
+class ColumnBatchWriter {
+public:
+    ColumnBatchWriter(std::ostream& os, const std::vector<R>& rows) : m_os(os), m_rows(rows) {}
+    template <typename T>
+    void operator()(const char*, T R::* member) {
+        std::vector<T> column(m_rows.size());
+        for (size_t i = 0; i < m_rows.size(); ++i) column[i] = m_rows[i].*member;
+        m_os.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+    }
+    std::ostream& m_os;
+    const std::vector<R>& m_rows;
+};
+
+class TraceBatchBase {
+public:
+    virtual ~TraceBatchBase() {}
+    virtual void Write() = 0;
+};
+
+// Writer thread dùng chung cho tất cả các stream. Hàng đợi có giới hạn để
+// bộ nhớ không phình ra nếu đĩa chậm hơn mô phỏng.
+class TraceWriter {
+public:
+    static TraceWriter& Get() { static TraceWriter instance; return instance; }
+
+    void Start(bool async, size_t maxPending) {
+        m_async = async; m_maxPending = maxPending;
+        if (m_async && !m_thread.joinable()) { m_stop = false; m_thread = std::thread(&TraceWriter::Loop, this); }
+    }
+
+    void Submit(std::unique_ptr<TraceBatchBase> batch) {
+        if (!m_async) { batch->Write(); return; }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_queue.size() < m_maxPending; });
+        m_queue.push_back(std::move(batch));
+        m_notEmpty.notify_one();
+    }
+
+    void Stop() {
+        if (!m_thread.joinable()) return;
+        { std::lock_guard<std::mutex> lock(m_mutex); m_stop = true; }
+        m_notEmpty.notify_one();
+        m_thread.join();
+    }
+
+private:
+    void Loop() {
+        for (;;) {
+            std::unique_ptr<TraceBatchBase> batch;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_notEmpty.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                if (m_queue.empty()) return; // m_stop và đã ghi hết
+                batch = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            m_notFull.notify_one();
+            batch->Write();
+        }
+    }
+
+    bool m_async = true;
+    bool m_stop = false;
+    size_t m_maxPending = 64;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty, m_notFull;
+    std::deque<std::unique_ptr<TraceBatchBase>> m_queue;
+};
+
+// Một file output với record kiểu R. Sau Open(), chỉ writer thread chạm vào m_file.
+template <typename R>
+class TraceStream {
+public:
+    void Open(const std::string& csvName, TraceFormat format, size_t batchSize) {
+        m_format = format; m_batchSize = batchSize; m_enabled = true;
+        std::string name = csvName;
+        if (format == TraceFormat::BINARY) name = name.substr(0, name.rfind('.')) + ".bin";
+        m_file.open(name, format == TraceFormat::BINARY ? std::ios::out | std::ios::binary : std::ios::out);
+        NS_ABORT_MSG_IF(!m_file.is_open(), "Cannot open trace file " << name);
+        if (format == TraceFormat::CSV) {
+            m_file << R::kCsvHeader << '\n';
+        } else {
+            uint32_t version = 1, ncols = 0;
+            CountColumns counter{ncols}; R::Columns(counter);
+            m_file.write("UAVTRACE", 8);
+            m_file.write(reinterpret_cast<const char*>(&version), 4);
+            m_file.write(reinterpret_cast<const char*>(&ncols), 4);
+            ColumnSchemaWriter schema(m_file); R::Columns(schema);
+        }
+        m_buffer.reserve(m_batchSize);
+    }
+
+    // Giữ record trong RAM khi chưa có file (warm-up của batch warm start); Open sau đó ghi
+    // phần đã giữ trước, DropHeld bỏ nếu run không mở stream này
+    void Hold() { m_enabled = true; }
+
+    void DropHeld() {
+        if (m_file.is_open()) return;
+        m_enabled = false;
+        std::vector<R>().swap(m_buffer);
+    }
+
+    // Stream chưa Open (raw trace tắt) thì bỏ qua record
+    void Write(const R& record) {
+        if (!m_enabled) return;
+        m_buffer.push_back(record);
+        if (m_buffer.size() >= m_batchSize && m_file.is_open()) Flush();
+    }
+
+    void Flush() {
+        PROFILE_SCOPE("TraceStream::Flush");
+        if (m_buffer.empty() || !m_file.is_open()) return;
+        std::unique_ptr<Batch> batch(new Batch(this));
+        batch->rows.swap(m_buffer);
+        m_buffer.reserve(m_batchSize);
+        TraceWriter::Get().Submit(std::move(batch));
+    }
+
+    // Gọi sau TraceWriter::Stop() để đóng file an toàn
+    void Close() { m_enabled = false; if (m_file.is_open()) m_file.close(); }
+
+private:
+    struct CountColumns {
+        uint32_t& n;
+        template <typename T> void operator()(const char*, T R::*) { ++n; }
+    };
+
+    struct Batch : public TraceBatchBase {
+        explicit Batch(TraceStream* s) : stream(s) {}
+        void Write() override { stream->WriteRows(rows); }
+        TraceStream* stream;
+        std::vector<R> rows;
+    };
+
+    void WriteRows(const std::vector<R>& rows) {
+        if (m_format == TraceFormat::CSV) {
+            for (const R& r : rows) r.WriteCsv(m_file);
+        } else {
+            uint32_t n = rows.size();
+            m_file.write(reinterpret_cast<const char*>(&n), 4);
+            ColumnBatchWriter<R> columns(m_file, rows); R::Columns(columns);
+        }
+    }
+
+    TraceFormat m_format = TraceFormat::CSV;
+    size_t m_batchSize = 4096;
+    bool m_enabled = false;
+    std::vector<R> m_buffer;
+    std::ofstream m_file;
+};
+
+// ---------- Record types (giữ nguyên schema cột của các file CSV cũ) ----------
+struct RsrpRecord {
+    double time; uint64_t imsi; uint16_t cellId; double rsrp;
+    static constexpr const char* kCsvHeader = "Time,IMSI,CellId,RSRP";
+    void WriteCsv(std::ostream& os) const { os << time << "," << imsi << "," << cellId << "," << rsrp << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &RsrpRecord::time); c("IMSI", &RsrpRecord::imsi); c("CellId", &RsrpRecord::cellId); c("RSRP", &RsrpRecord::rsrp);
+    }
+};
+
+struct SinrRecord {
+    double time; uint64_t imsi; double sinr;
+    static constexpr const char* kCsvHeader = "Time,IMSI,SINR";
+    void WriteCsv(std::ostream& os) const { os << time << "," << imsi << "," << sinr << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &SinrRecord::time); c("IMSI", &SinrRecord::imsi); c("SINR", &SinrRecord::sinr);
+    }
+};
+
+struct ThroughputRecord {
+    double time; uint32_t ueId; double throughput;
+    static constexpr const char* kCsvHeader = "Time,UE_ID,Throughput_Mbps";
+    void WriteCsv(std::ostream& os) const { os << time << "," << ueId << "," << throughput << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &ThroughputRecord::time); c("UE_ID", &ThroughputRecord::ueId); c("Throughput_Mbps", &ThroughputRecord::throughput);
+    }
+};
+
+struct HandoverRecord {
+    double time; uint64_t imsi; uint16_t targetCellId; uint32_t handoverCount; uint8_t pingPong;
+    static constexpr const char* kCsvHeader = "Time,IMSI,TargetCellId,HandoverCount,PingPong";
+    void WriteCsv(std::ostream& os) const { os << time << "," << imsi << "," << targetCellId << "," << handoverCount << "," << (int)pingPong << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &HandoverRecord::time); c("IMSI", &HandoverRecord::imsi); c("TargetCellId", &HandoverRecord::targetCellId);
+        c("HandoverCount", &HandoverRecord::handoverCount); c("PingPong", &HandoverRecord::pingPong);
+    }
+};
+
+// NodeName trong CSV = "UE<n>" hoặc "UAV<n>"; file binary lưu số thứ tự node
+struct PositionRecord {
+    double time; uint8_t isUav; uint32_t nodeIndex; double x; double y; double z;
+    static constexpr const char* kCsvHeader = "Time,NodeName,X,Y,Z";
+    void WriteCsv(std::ostream& os) const { os << time << "," << (isUav ? "UAV" : "UE") << nodeIndex << "," << x << "," << y << "," << z << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &PositionRecord::time); c("NodeName", &PositionRecord::nodeIndex);
+        c("X", &PositionRecord::x); c("Y", &PositionRecord::y); c("Z", &PositionRecord::z);
+    }
+};
+
+struct CellIdRecord {
+    double time; uint64_t imsi; uint16_t cellId;
+    static constexpr const char* kCsvHeader = "Time,IMSI,CellId";
+    void WriteCsv(std::ostream& os) const { os << time << "," << imsi << "," << cellId << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &CellIdRecord::time); c("IMSI", &CellIdRecord::imsi); c("CellId", &CellIdRecord::cellId);
+    }
+};
+
+struct HandoverQualityRecord {
+    double time; uint64_t imsi; uint16_t source; uint16_t target; uint8_t pingPong;
+    double duration; double tpBefore; double tpAfter; double degradation;
+    static constexpr const char* kCsvHeader = "Time,IMSI,Source,Target,PingPong,Duration,TpBefore,TpAfter,Degradation";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << imsi << "," << source << "," << target << "," << (pingPong ? "Yes" : "No") << ","
+           << duration << "," << tpBefore << "," << tpAfter << "," << degradation << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &HandoverQualityRecord::time); c("IMSI", &HandoverQualityRecord::imsi);
+        c("Source", &HandoverQualityRecord::source); c("Target", &HandoverQualityRecord::target);
+        c("PingPong", &HandoverQualityRecord::pingPong); c("Duration", &HandoverQualityRecord::duration);
+        c("TpBefore", &HandoverQualityRecord::tpBefore); c("TpAfter", &HandoverQualityRecord::tpAfter);
+        c("Degradation", &HandoverQualityRecord::degradation);
+    }
+};
+
+struct MecOffloadRecord {
+    double time; uint32_t ueId; uint32_t taskId; uint8_t offloaded; double latency; double throughput; double migrationPenalty;
+    static constexpr const char* kCsvHeader = "Time,UE_ID,TaskID,Type,Latency,Throughput,MigrationPenalty";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << ueId << "," << taskId << "," << (offloaded ? "UAV-MEC" : "Local") << ","
+           << latency << "," << throughput << "," << migrationPenalty << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &MecOffloadRecord::time); c("UE_ID", &MecOffloadRecord::ueId); c("TaskID", &MecOffloadRecord::taskId);
+        c("Type", &MecOffloadRecord::offloaded); c("Latency", &MecOffloadRecord::latency);
+        c("Throughput", &MecOffloadRecord::throughput); c("MigrationPenalty", &MecOffloadRecord::migrationPenalty);
+    }
+};
+
+// Một quyết định offload: dự đoán của policy lúc sinh task và kết quả thật lúc task xong (-1 = mất)
+struct OffloadDecisionRecord {
+    double time; uint32_t ueId; uint32_t taskId; double fraction; double throughput;
+    double predLatency; double predEnergy; double latency; double energy; double decisionNs;
+    static constexpr const char* kCsvHeader =
+        "Time,UE_ID,TaskID,Fraction,PredThroughput,PredLatency,PredEnergy(J),Latency,Energy(J),DecisionNs";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << ueId << "," << taskId << "," << fraction << "," << throughput << "," << predLatency << ","
+           << predEnergy << "," << latency << "," << energy << "," << decisionNs << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &OffloadDecisionRecord::time); c("UE_ID", &OffloadDecisionRecord::ueId);
+        c("TaskID", &OffloadDecisionRecord::taskId); c("Fraction", &OffloadDecisionRecord::fraction);
+        c("PredThroughput", &OffloadDecisionRecord::throughput); c("PredLatency", &OffloadDecisionRecord::predLatency);
+        c("PredEnergy", &OffloadDecisionRecord::predEnergy); c("Latency", &OffloadDecisionRecord::latency);
+        c("Energy", &OffloadDecisionRecord::energy); c("DecisionNs", &OffloadDecisionRecord::decisionNs);
+    }
+};
+
+struct HoTraceRecord {
+    double time; uint64_t imsi; uint16_t fromCell; uint16_t toCell;
+    static constexpr const char* kCsvHeader = "Time(s),UE_ID,From_Cell,To_Cell";
+    void WriteCsv(std::ostream& os) const { os << time << "," << imsi << "," << fromCell << "," << toCell << '\n'; }
+    template <typename C> static void Columns(C& c) {
+        c("Time(s)", &HoTraceRecord::time); c("UE_ID", &HoTraceRecord::imsi);
+        c("From_Cell", &HoTraceRecord::fromCell); c("To_Cell", &HoTraceRecord::toCell);
+    }
+};
+
+// Địa chỉ IPv4 lưu dạng uint32 (host order), CSV in lại dạng a.b.c.d
+struct FlowStatsRecord {
+    uint32_t flowId; uint32_t src; uint32_t dst; uint32_t txPkts; uint32_t rxPkts; uint32_t lostPkts;
+    double lossRate; double delayMs; double jitterMs;
+    static constexpr const char* kCsvHeader = "FlowID,Src,Dst,TxPkts,RxPkts,LostPkts,LossRate,Delay(ms),Jitter(ms)";
+    static void WriteIp(std::ostream& os, uint32_t a) { os << (a >> 24) << "." << ((a >> 16) & 0xff) << "." << ((a >> 8) & 0xff) << "." << (a & 0xff); }
+    void WriteCsv(std::ostream& os) const {
+        os << flowId << ","; WriteIp(os, src); os << ","; WriteIp(os, dst);
+        os << "," << txPkts << "," << rxPkts << "," << lostPkts << "," << lossRate << "," << delayMs << "," << jitterMs << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("FlowID", &FlowStatsRecord::flowId); c("Src", &FlowStatsRecord::src); c("Dst", &FlowStatsRecord::dst);
+        c("TxPkts", &FlowStatsRecord::txPkts); c("RxPkts", &FlowStatsRecord::rxPkts); c("LostPkts", &FlowStatsRecord::lostPkts);
+        c("LossRate", &FlowStatsRecord::lossRate); c("Delay(ms)", &FlowStatsRecord::delayMs); c("Jitter(ms)", &FlowStatsRecord::jitterMs);
+    }
+};
+
+// Chi tiết từng task offload: các thành phần độ trễ (s); -1 = task mất/quá hạn
+struct MecTaskRecord {
+    double time; uint32_t ueId; uint32_t taskId; uint16_t cellId;
+    double uplink; double queue; double processing; double downlink; double latency; uint8_t deadlineMet;
+    static constexpr const char* kCsvHeader = "Time,UE_ID,TaskID,CellId,Uplink,Queue,Processing,Downlink,Latency,DeadlineMet";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << ueId << "," << taskId << "," << cellId << "," << uplink << "," << queue << ","
+           << processing << "," << downlink << "," << latency << "," << (int)deadlineMet << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &MecTaskRecord::time); c("UE_ID", &MecTaskRecord::ueId); c("TaskID", &MecTaskRecord::taskId);
+        c("CellId", &MecTaskRecord::cellId); c("Uplink", &MecTaskRecord::uplink); c("Queue", &MecTaskRecord::queue);
+        c("Processing", &MecTaskRecord::processing); c("Downlink", &MecTaskRecord::downlink);
+        c("Latency", &MecTaskRecord::latency); c("DeadlineMet", &MecTaskRecord::deadlineMet);
+    }
+};
+
+// User-plane quanh một handover: từ gói cuối ở cell cũ tới hết cửa sổ sau gói đầu ở cell mới
+struct HoInterruptionRecord {
+    double time; uint32_t ueId; uint16_t source; uint16_t target; double interruptionMs;
+    uint32_t lost; uint32_t reordered; uint32_t maxLossBurst; double maxDelayMs;
+    static constexpr const char* kCsvHeader = "Time,UE_ID,Source,Target,Interruption(ms),LostPackets,Reordered,MaxLossBurst,MaxDelay(ms)";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << ueId << "," << source << "," << target << "," << interruptionMs << "," << lost << ","
+           << reordered << "," << maxLossBurst << "," << maxDelayMs << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &HoInterruptionRecord::time); c("UE_ID", &HoInterruptionRecord::ueId);
+        c("Source", &HoInterruptionRecord::source); c("Target", &HoInterruptionRecord::target);
+        c("Interruption(ms)", &HoInterruptionRecord::interruptionMs); c("LostPackets", &HoInterruptionRecord::lost);
+        c("Reordered", &HoInterruptionRecord::reordered); c("MaxLossBurst", &HoInterruptionRecord::maxLossBurst);
+        c("MaxDelay(ms)", &HoInterruptionRecord::maxDelayMs);
+    }
+};
+
+// Một lỗi mobility đã phân loại (RLF / HO lỗi rồi UE kết nối lại ở Reconnect)
+struct HandoverIssueRecord {
+    double time; uint64_t imsi; uint8_t type; uint16_t source; uint16_t target; uint16_t reconnect;
+    static constexpr const char* kCsvHeader = "Time,IMSI,Type,Source,Target,Reconnect";
+    void WriteCsv(std::ostream& os) const {
+        static const char* kNames[] = {"PingPong", "TooEarly", "TooLate", "WrongCell"};
+        os << time << "," << imsi << "," << kNames[type] << "," << source << "," << target << "," << reconnect << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &HandoverIssueRecord::time); c("IMSI", &HandoverIssueRecord::imsi); c("Type", &HandoverIssueRecord::type);
+        c("Source", &HandoverIssueRecord::source); c("Target", &HandoverIssueRecord::target);
+        c("Reconnect", &HandoverIssueRecord::reconnect);
+    }
+};
+
+// Một lần chuyển state container qua X2 (đã đi hết mọi hop)
+struct MigrationRecord {
+    double time; uint32_t ueId; uint16_t fromCell; uint16_t toCell; uint8_t kind; uint64_t bytes; double duration; uint8_t hops;
+    static constexpr const char* kCsvHeader = "Time,UE_ID,From_Cell,To_Cell,Kind,Bytes,Duration,Hops";
+    static const char* KindName(uint8_t k) { return k == 0 ? "Full" : (k == 1 ? "PreCopy" : "Delta"); }
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << ueId << "," << fromCell << "," << toCell << "," << KindName(kind) << ","
+           << bytes << "," << duration << "," << (int)hops << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &MigrationRecord::time); c("UE_ID", &MigrationRecord::ueId);
+        c("From_Cell", &MigrationRecord::fromCell); c("To_Cell", &MigrationRecord::toCell);
+        c("Kind", &MigrationRecord::kind); c("Bytes", &MigrationRecord::bytes);
+        c("Duration", &MigrationRecord::duration); c("Hops", &MigrationRecord::hops);
+    }
+};
+
+// Một quyết định đặt vị trí UAV: vị trí lúc quyết định -> đích, điểm mô hình của cả mạng trước / sau
+struct PlacementRecord {
+    double time; uint16_t cellId; double x; double y; double z; double targetX; double targetY; double targetZ;
+    double scoreBefore; double scoreAfter;
+    static constexpr const char* kCsvHeader = "Time,CellId,X,Y,Z,Target_X,Target_Y,Target_Z,Score_Before(Mbps),Score_After(Mbps)";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << cellId << "," << x << "," << y << "," << z << "," << targetX << "," << targetY << ","
+           << targetZ << "," << scoreBefore << "," << scoreAfter << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &PlacementRecord::time); c("CellId", &PlacementRecord::cellId);
+        c("X", &PlacementRecord::x); c("Y", &PlacementRecord::y); c("Z", &PlacementRecord::z);
+        c("Target_X", &PlacementRecord::targetX); c("Target_Y", &PlacementRecord::targetY); c("Target_Z", &PlacementRecord::targetZ);
+        c("Score_Before", &PlacementRecord::scoreBefore); c("Score_After", &PlacementRecord::scoreAfter);
+    }
+};
+
+// Tải của một cell trong một khoảng lấy mẫu capacity (traffic profile)
+struct CellCapacityRecord {
+    double time; uint16_t cellId; uint32_t ues; uint32_t hoUes; double offered; double delivered; double lossRate;
+    static constexpr const char* kCsvHeader = "Time,CellId,Ues,HandoverUes,OfferedMbps,DeliveredMbps,LossRate(%)";
+    void WriteCsv(std::ostream& os) const {
+        os << time << "," << cellId << "," << ues << "," << hoUes << "," << offered << "," << delivered << "," << lossRate << '\n';
+    }
+    template <typename C> static void Columns(C& c) {
+        c("Time", &CellCapacityRecord::time); c("CellId", &CellCapacityRecord::cellId); c("Ues", &CellCapacityRecord::ues);
+        c("HandoverUes", &CellCapacityRecord::hoUes); c("OfferedMbps", &CellCapacityRecord::offered);
+        c("DeliveredMbps", &CellCapacityRecord::delivered); c("LossRate", &CellCapacityRecord::lossRate);
+    }
+};
+
 // ========== biến toàn cục và struct ==========
-std::ofstream rsrpFile, sinrFile, throughputFile, handoverFile, positionFile, cellIdFile, handoverQualityFile, uavPositionFile, mecOffloadFile, hoTraceFile, flowStatsFile;
+TraceStream<RsrpRecord> rsrpFile;
+TraceStream<SinrRecord> sinrFile;
+TraceStream<ThroughputRecord> throughputFile;
+TraceStream<HandoverRecord> handoverFile;
+TraceStream<PositionRecord> positionFile, uavPositionFile;
+TraceStream<CellIdRecord> cellIdFile;
+TraceStream<HandoverQualityRecord> handoverQualityFile;
+TraceStream<MecOffloadRecord> mecOffloadFile;
+TraceStream<OffloadDecisionRecord> offloadDecisionFile;
+TraceStream<HoTraceRecord> hoTraceFile;
+TraceStream<FlowStatsRecord> flowStatsFile;
+TraceStream<MecTaskRecord> mecTaskFile;
+TraceStream<MigrationRecord> migrationFile;
+TraceStream<HoInterruptionRecord> hoInterruptionFile;
+TraceStream<HandoverIssueRecord> handoverIssueFile;
+TraceStream<PlacementRecord> placementFile;
+TraceStream<CellCapacityRecord> cellCapacityFile;
+
+template <typename F>
+void ForEachTraceStream(F f) {
+    f(rsrpFile); f(sinrFile); f(throughputFile); f(handoverFile); f(positionFile); f(uavPositionFile);
+    f(cellIdFile); f(handoverQualityFile); f(mecOffloadFile); f(offloadDecisionFile); f(hoTraceFile);
+    f(flowStatsFile); f(mecTaskFile); f(migrationFile); f(hoInterruptionFile); f(handoverIssueFile); f(placementFile);
+    f(cellCapacityFile);
+}
 
 uint32_t handoverCount = 0;
 uint32_t handoverStartCount = 0;
-std::map<uint32_t, uint64_t> totalRxBytes;
-std::map<uint32_t, double> lastThroughput;
-
-// Map theo dõi UE đang ở Cell nào
-std::map<uint32_t, uint16_t> ueCurrentCellMap;
-std::map<uint32_t, uint16_t> uePreviousMecCellMap; 
-
 struct HandoverEvent {
     double time; uint64_t imsi; uint16_t sourceCellId; uint16_t targetCellId;
     double rsrpBefore; double rsrpAfter; double throughputBefore; double throughputAfter;
 };
 
-std::map<uint64_t, std::deque<uint16_t>> ueHandoverHistory; 
-std::map<uint64_t, HandoverEvent> lastHandoverEvent;
+// Ring buffer kích thước cố định, không cấp phát động (thay cho std::deque)
+template <typename T, uint32_t N>
+class RingBuffer {
+public:
+    void Push(const T& value) {
+        m_data[(m_head + m_size) % N] = value;
+        if (m_size < N) m_size++; else m_head = (m_head + 1) % N;
+    }
+    uint32_t Size() const { return m_size; }
+    // k = 0 là phần tử mới nhất
+    const T& Recent(uint32_t k) const { return m_data[(m_head + m_size - 1 - k) % N]; }
+private:
+    T m_data[N] = {};
+    uint32_t m_head = 0, m_size = 0;
+};
+
+// Gói downlink TrafficSource -> PacketSink của một UE, đọc từ SeqTsHeader gắn trong mỗi gói.
+// Chỉ giữ bộ đếm kích thước cố định; cửa sổ handover mở ở HandoverStart, gói đầu tiên sau
+// đó cho ra thời gian gián đoạn, đóng sau kHoWindow giây kể từ gói đầu ở cell mới.
+struct PacketStats {
+    bool any = false;
+    uint32_t highestSeq = 0;
+    uint64_t received = 0, lost = 0, reordered = 0, lossBursts = 0;
+    uint32_t maxLossBurst = 0;
+    double lastRx = -1.0;
+    uint32_t handovers = 0;
+    double interruptionSum = 0.0, interruptionMax = 0.0;
+    // Cửa sổ handover đang mở
+    bool hoOpen = false, hoWaitingFirst = false;
+    uint16_t hoSource = 0, hoTarget = 0;
+    double hoStart = 0.0, hoLastSourceRx = -1.0, hoWindowEnd = 0.0, hoInterruption = 0.0, hoMaxDelay = 0.0;
+    uint32_t hoLost = 0, hoReordered = 0, hoMaxBurst = 0;
+};
+
+// Máy trạng thái handover của một UE, kích thước cố định: HO đang chạy, HO thành công gần nhất
+// (cho ping-pong / too-early / wrong-cell) và lần mất kết nối đang chờ UE kết nối lại để phân loại.
+enum class HoPhase : uint8_t { CONNECTED, HANDOVER, DETACHED };
+struct HandoverTracker {
+    HoPhase phase = HoPhase::CONNECTED;
+    uint16_t source = 0, target = 0;           // HO đang chạy (HANDOVER) hoặc HO lỗi (DETACHED)
+    double start = 0.0;
+    uint16_t lastSource = 0, lastTarget = 0;   // HO thành công gần nhất
+    double lastEnd = -1e9;
+    uint16_t lostCell = 0;                     // DETACHED: serving cell lúc mất kết nối
+    double lostAt = 0.0;
+    bool lostInHandover = false;               // HO lỗi / RLF giữa HO, không phải RLF thường
+};
+
+// Toàn bộ state của một UE nằm liền nhau trong một slot
+struct UeState {
+    uint32_t ueId = 0;              // = slot + 1, dùng trong CSV
+    uint64_t imsi = 0;
+    uint64_t totalRxBytes = 0;
+    uint64_t offeredBytes = 0;      // byte downlink nguồn traffic đã phát cho UE
+    double lastThroughput = 0.0;
+    RingBuffer<float, 32> thptHistory;  // các mẫu throughput 100 ms gần nhất, cho bộ dự đoán offload
+    double lastSinrDb = NAN;        // SINR báo cáo gần nhất (NaN = chưa có)
+    uint16_t currentCell = 0;       // UE đang ở Cell nào
+    bool hasHandoverEvent = false;
+    HandoverEvent lastHandover;
+    HandoverTracker hoTracker;
+    PacketStats packets;
+};
+
+// Mảng liên tục, đánh chỉ số theo slot (= thứ tự UE trong globalUeNodes), dựng một lần lúc setup.
+// IMSI -> slot là một vector tra trực tiếp; callback nào biết trước UE thì bind con trỏ UeState luôn.
+class UeStateTable {
+public:
+    void Build(uint32_t numUes) {
+        m_states.assign(numUes, UeState());
+        for (uint32_t i = 0; i < numUes; ++i) m_states[i].ueId = i + 1;
+    }
+    void BindImsi(uint32_t slot, uint64_t imsi) {
+        m_states[slot].imsi = imsi;
+        if (imsi >= m_imsiToSlot.size()) m_imsiToSlot.resize(imsi + 1, kNoSlot);
+        m_imsiToSlot[imsi] = slot;
+    }
+    UeState* FindByImsi(uint64_t imsi) {
+        if (imsi >= m_imsiToSlot.size() || m_imsiToSlot[imsi] == kNoSlot) return nullptr;
+        return &m_states[m_imsiToSlot[imsi]];
+    }
+    UeState& operator[](uint32_t slot) { return m_states[slot]; }
+    uint32_t Size() const { return m_states.size(); }
+private:
+    static constexpr uint32_t kNoSlot = 0xffffffff;
+    std::vector<UeState> m_states;
+    std::vector<uint32_t> m_imsiToSlot;
+};
+
+UeStateTable ueState;
 uint32_t pingPongHandoverCount = 0;
 
 // Visual Globals
 AnimationInterface *pAnim = 0; 
 NodeContainer globalUeNodes;
 
+// Sink của từng UE (index = UE_ID - 1)
+std::vector<Ptr<PacketSink>> ueSinks;
+
 struct OffloadTask {
     uint32_t taskId; double latency; bool offloaded; double energy;
 };
 std::vector<OffloadTask> offloadTasks;
 uint32_t taskCounter = 0;
 
+// ==================== PERIODIC PROBES ====================
+// Mỗi probe là một hàm lấy mẫu định kỳ (một UE, một UAV...). Các probe cùng chu kỳ
+// và cùng thời điểm bắt đầu được gom vào một group; mỗi group chỉ giữ đúng một event
+// trong scheduler và tự lên lịch lần kế tiếp khi chạy xong. Thời điểm lần thứ k được
+// tính bằng số nguyên start + k*period nên không bị trôi như cộng dồn t += 0.1.
+class PeriodicSampler {
+public:
+    static PeriodicSampler& Get() { static PeriodicSampler instance; return instance; }
+
+    // Probe chạy tại start, start+period, ... cho đến trước stop
+    uint32_t Register(Time period, Time start, Time stop, std::function<void()> fn) {
+        NS_ABORT_MSG_IF(!period.IsStrictlyPositive(), "Probe period must be positive");
+        std::pair<int64_t, int64_t> key(period.GetTimeStep(), start.GetTimeStep());
+        ProbeGroup& g = m_groups[key];
+        if (g.probes.empty()) { g.periodTs = key.first; g.startTs = key.second; g.tick = 0; }
+        uint32_t id = m_index.size();
+        g.probes.push_back({fn, stop.GetTimeStep(), true});
+        m_index.push_back({&g, g.probes.size() - 1});
+        if (!g.event.IsPending()) ScheduleNext(g);
+        return id;
+    }
+
+    // Dừng một probe trước hạn; group tự dừng khi không còn probe nào hoạt động
+    void Stop(uint32_t id) { m_index[id].first->probes[m_index[id].second].active = false; }
+
+    uint32_t GetNGroups() const { return m_groups.size(); }
+
+private:
+    struct Probe { std::function<void()> fn; int64_t stopTs; bool active; };
+    struct ProbeGroup {
+        int64_t periodTs = 0, startTs = 0;
+        uint64_t tick = 0;
+        std::vector<Probe> probes;
+        EventId event;
+    };
+
+    void ScheduleNext(ProbeGroup& g) {
+        int64_t now = Simulator::Now().GetTimeStep();
+        // Đăng ký giữa chừng: bỏ qua các tick đã qua
+        if (g.startTs + g.periodTs * (int64_t)g.tick < now) g.tick = (now - g.startTs + g.periodTs - 1) / g.periodTs;
+        int64_t next = g.startTs + g.periodTs * (int64_t)g.tick;
+        bool alive = false;
+        for (const Probe& p : g.probes) alive = alive || (p.active && next < p.stopTs);
+        if (alive) g.event = Simulator::Schedule(TimeStep(next - now), &PeriodicSampler::Fire, this, &g);
+    }
+
+    void Fire(ProbeGroup* g) {
+        PROFILE_SCOPE("PeriodicSampler::Fire");
+        int64_t now = Simulator::Now().GetTimeStep();
+        for (Probe& p : g->probes) {
+            if (!p.active) continue;
+            if (now >= p.stopTs) { p.active = false; continue; }
+            p.fn();
+        }
+        g->tick++;
+        ScheduleNext(*g);
+    }
+
+    std::map<std::pair<int64_t, int64_t>, ProbeGroup> m_groups;
+    std::vector<std::pair<ProbeGroup*, size_t>> m_index;
+};
+
+// ==================== KPI AGGREGATION ====================
+// Histogram log-bucket kiểu HDR, đếm trên số nguyên x = (value + offset) * scale.
+// x < 2^kSubBits: mỗi giá trị một bucket; lớn hơn: mỗi lũy thừa 2 chia 2^(kSubBits-1) bucket
+// nên sai số tương đối của percentile <= ~3%. Kích thước cố định, cấp phát ở mẫu đầu tiên
+// (UE/cell không có mẫu của metric nào thì không tốn bộ nhớ cho metric đó).
+class LogHistogram {
+public:
+    static const uint32_t kSubBits = 5;
+    static const uint32_t kMaxBits = 40;   // giá trị lớn hơn bị kẹp vào bucket cuối
+    static const uint32_t kBuckets = (1u << kSubBits) + (kMaxBits - kSubBits) * (1u << (kSubBits - 1));
+
+    void Record(uint64_t x, uint64_t n = 1) {
+        if (n == 0) return;
+        if (m_counts.empty()) m_counts.assign(kBuckets, 0);
+        x = std::min<uint64_t>(x, (1ull << kMaxBits) - 1);
+        m_counts[Index(x)] += n;
+        m_min = m_count ? std::min(m_min, x) : x;
+        m_max = m_count ? std::max(m_max, x) : x;
+        m_count += n;
+        m_sum += (double)x * n;
+    }
+
+    // Giá trị (đã mã hóa) tại percentile q: trung điểm bucket, kẹp trong [min, max]
+    double ValueAt(double q) const {
+        if (m_count == 0) return 0.0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q / 100.0 * m_count)), seen = 0;
+        for (uint32_t i = 0; i < kBuckets; ++i) {
+            seen += m_counts[i];
+            if (seen < rank) continue;
+            uint64_t lo, width;
+            Bounds(i, lo, width);
+            return std::min<double>(std::max<double>(lo + (width - 1) / 2.0, m_min), m_max);
+        }
+        return m_max;
+    }
+
+    void Reset() { std::fill(m_counts.begin(), m_counts.end(), 0); m_count = 0; m_sum = 0.0; }
+    uint64_t Count() const { return m_count; }
+    double Mean() const { return m_count ? m_sum / m_count : 0.0; }
+    uint64_t Min() const { return m_count ? m_min : 0; }
+    uint64_t Max() const { return m_count ? m_max : 0; }
+
+private:
+    static uint32_t Index(uint64_t x) {
+        const uint64_t sub = 1ull << kSubBits;
+        if (x < sub) return x;
+        uint32_t e = (63 - __builtin_clzll(x)) - kSubBits + 1;
+        return sub + (e - 1) * (sub / 2) + ((x >> e) - sub / 2);
+    }
+    static void Bounds(uint32_t i, uint64_t& lo, uint64_t& width) {
+        const uint64_t sub = 1ull << kSubBits;
+        if (i < sub) { lo = i; width = 1; return; }
+        uint32_t e = (i - sub) / (sub / 2) + 1;
+        lo = ((i - sub) % (sub / 2) + sub / 2) << e;
+        width = 1ull << e;
+    }
+
+    std::vector<uint32_t> m_counts;
+    uint64_t m_count = 0, m_min = 0, m_max = 0;
+    double m_sum = 0.0;
+};
+
+enum KpiMetric { KPI_MEC_LATENCY, KPI_THROUGHPUT, KPI_SINR, KPI_HO_INTERRUPTION, KPI_PACKET_DELAY, KPI_NUM_METRICS };
+
+struct KpiMetricInfo { const char* name; const char* unit; double scale; double offset; };
+// scale/offset: độ phân giải 1 us, 1 kbps, 0.01 dB; SINR dịch +50 dB để không âm
+const KpiMetricInfo kKpiMetrics[KPI_NUM_METRICS] = {
+    {"MecLatency", "ms", 1000.0, 0.0},
+    {"Throughput", "Mbps", 1000.0, 0.0},
+    {"SINR", "dB", 100.0, 50.0},
+    {"HoInterruption", "ms", 1000.0, 0.0},
+    {"PacketDelay", "ms", 1000.0, 0.0},
+};
+
+// Thống kê online theo UE, theo cell, theo flow và toàn cục. Bộ nhớ không phụ thuộc
+// độ dài mô phỏng; thay cho việc ghi mọi mẫu ra CSV rồi tính percentile offline.
+class KpiAggregator {
+public:
+    typedef std::array<LogHistogram, KPI_NUM_METRICS> MetricSet;
+
+    void Configure(uint32_t numUes, uint32_t numCells) {
+        m_ue.assign(numUes, MetricSet());
+        m_cell.assign(numCells, MetricSet());
+        m_cellInterval.assign(numCells, MetricSet());
+        m_global = MetricSet(); m_interval = MetricSet();
+        m_flow.clear();
+    }
+
+    // slot / cellId ngoài phạm vi thì chỉ tính vào toàn cục
+    void Record(KpiMetric m, uint32_t slot, uint16_t cellId, double value, uint64_t n = 1) {
+        uint64_t x = Encode(m, value);
+        m_global[m].Record(x, n);
+        m_interval[m].Record(x, n);
+        if (slot < m_ue.size()) m_ue[slot][m].Record(x, n);
+        if (cellId >= 1 && cellId <= m_cell.size()) {
+            m_cell[cellId - 1][m].Record(x, n);
+            m_cellInterval[cellId - 1][m].Record(x, n);
+        }
+    }
+
+    void RecordFlow(uint32_t flowId, KpiMetric m, double value, uint64_t n = 1) {
+        m_flow[flowId][m].Record(Encode(m, value), n);
+    }
+
+    void OpenIntervals(const std::string& path) {
+        m_intervalFile.open(path);
+        m_intervalFile << "Time,Scope,Id,Metric,Count,Mean,Min,P50,P95,P99,Max\n";
+    }
+
+    // Thống kê của khoảng vừa qua (toàn cục + từng cell), rồi xóa để đếm khoảng kế tiếp
+    void WriteInterval(double time) {
+        std::ostringstream prefix; prefix << time << ",";
+        WriteSet(m_intervalFile, prefix.str() + "global,0", m_interval, false);
+        for (LogHistogram& h : m_interval) h.Reset();
+        for (uint32_t c = 0; c < m_cellInterval.size(); ++c) {
+            WriteSet(m_intervalFile, prefix.str() + "cell," + std::to_string(c + 1), m_cellInterval[c], false);
+            for (LogHistogram& h : m_cellInterval[c]) h.Reset();
+        }
+    }
+
+    void WriteSummary(const std::string& path) {
+        std::ofstream out(path);
+        out << "Scope,Id,Metric,Unit,Count,Mean,Min,P50,P95,P99,Max\n";
+        WriteSet(out, "global,0", m_global, true);
+        for (uint32_t c = 0; c < m_cell.size(); ++c) WriteSet(out, "cell," + std::to_string(c + 1), m_cell[c], true);
+        for (uint32_t u = 0; u < m_ue.size(); ++u) WriteSet(out, "ue," + std::to_string(u + 1), m_ue[u], true);
+        for (const auto& entry : m_flow) WriteSet(out, "flow," + std::to_string(entry.first), entry.second, true);
+        if (m_intervalFile.is_open()) m_intervalFile.close();
+    }
+
+    double GlobalMean(KpiMetric m) const { return Decode(m, m_global[m].Mean()); }
+
+    void Print(std::ostream& os) const {
+        for (uint32_t m = 0; m < KPI_NUM_METRICS; ++m) {
+            const LogHistogram& h = m_global[m];
+            if (h.Count() == 0) continue;
+            os << "KPI " << kKpiMetrics[m].name << " (" << kKpiMetrics[m].unit << "): n=" << h.Count()
+               << " mean " << Decode(m, h.Mean()) << " | p50/p95/p99 " << Decode(m, h.ValueAt(50)) << " / "
+               << Decode(m, h.ValueAt(95)) << " / " << Decode(m, h.ValueAt(99))
+               << " | min/max " << Decode(m, h.Min()) << " / " << Decode(m, h.Max()) << std::endl;
+        }
+    }
+
+private:
+    static uint64_t Encode(uint32_t m, double value) {
+        double x = (value + kKpiMetrics[m].offset) * kKpiMetrics[m].scale;
+        return x > 0.0 ? (uint64_t)(x + 0.5) : 0;
+    }
+    static double Decode(uint32_t m, double x) { return x / kKpiMetrics[m].scale - kKpiMetrics[m].offset; }
+
+    static void WriteSet(std::ostream& os, const std::string& scope, const MetricSet& set, bool withUnit) {
+        for (uint32_t m = 0; m < KPI_NUM_METRICS; ++m) {
+            const LogHistogram& h = set[m];
+            if (h.Count() == 0) continue;
+            os << scope << "," << kKpiMetrics[m].name << ",";
+            if (withUnit) os << kKpiMetrics[m].unit << ",";
+            os << h.Count() << "," << Decode(m, h.Mean()) << "," << Decode(m, h.Min()) << ","
+               << Decode(m, h.ValueAt(50)) << "," << Decode(m, h.ValueAt(95)) << "," << Decode(m, h.ValueAt(99)) << ","
+               << Decode(m, h.Max()) << "\n";
+        }
+    }
+
+    MetricSet m_global, m_interval;
+    std::vector<MetricSet> m_ue;             // index = slot
+    std::vector<MetricSet> m_cell, m_cellInterval;   // index = cellId - 1
+    std::map<uint32_t, MetricSet> m_flow;    // FlowId của FlowMonitor
+    std::ofstream m_intervalFile;
+};
+
+KpiAggregator kpiStats;
+
 // ============== VISUAL HELPER ======================
+// Cell 1-3 giữ màu cũ; các cell khác lấy hue theo tỉ lệ vàng để các cell kề nhau khác màu
+void CellColor(uint16_t cellId, uint8_t& r, uint8_t& g, uint8_t& b) {
+    if (cellId == 1) { r=255; g=0; b=0; }      
+    else if (cellId == 2) { r=0; g=255; b=0; } 
+    else if (cellId == 3) { r=128; g=0; b=128; }
+    else if (cellId == 0) { r=100; g=100; b=100; } // Unknown cell
+    else {
+        double h = std::fmod(cellId * 0.618033988749895, 1.0) * 6.0;
+        double x = 1.0 - std::fabs(std::fmod(h, 2.0) - 1.0);
+        double rgb[6][3] = {{1,x,0},{x,1,0},{0,1,x},{0,x,1},{x,0,1},{1,0,x}};
+        const double* c = rgb[(int)h % 6];
+        r = 40 + 215 * c[0]; g = 40 + 215 * c[1]; b = 40 + 215 * c[2];
+    }
+}
+
+// Animation "positions": keyframe vị trí đã decimate + sự kiện đổi cell, không hook theo gói.
+// CSV: "N,id,UAV|UE,index" khai báo node, "P,t,id,x,y,z" vị trí, "C,t,id,cell" đổi cell.
+// Binary (--traceFormat=bin): magic "UAVANIM1", sau đó record packed little-endian
+// type(u8) 0 = node [id u32, isUav u8, index u32], 1 = vị trí [t f32, id u32, x y z f32],
+// 2 = đổi cell [t f32, id u32, cell u16]. Với gzip, dữ liệu được nén qua pipe "gzip -c".
+class AnimationRecorder {
+public:
+    void Open(const std::string& csvName, bool binary, bool gzip, double minMove) {
+        m_binary = binary; m_minMove = minMove;
+        std::string name = binary ? csvName.substr(0, csvName.rfind('.')) + ".bin" : csvName;
+        if (gzip) {
+            m_gzip = true;
+            m_file = ::popen(("gzip -c > '" + name + ".gz'").c_str(), "w");
+        } else {
+            m_file = std::fopen(name.c_str(), "wb");
+        }
+        NS_ABORT_MSG_IF(!m_file, "Cannot open animation file " << name);
+        if (m_binary) Append("UAVANIM1", 8);
+    }
+
+    // id = thứ tự AddNode (UAV trước, UE sau)
+    void AddNode(Ptr<MobilityModel> mobility, bool isUav, uint32_t index) {
+        uint32_t id = m_nodes.size();
+        m_nodes.push_back({mobility, Vector(), false});
+        if (isUav) m_uavCount++;
+        if (m_binary) { uint8_t type = 0, uav = isUav; Put(type); Put(id); Put(uav); Put(index); }
+        else Text("N,%u,%s,%u\n", id, isUav ? "UAV" : "UE", index);
+    }
+
+    // Chỉ ghi node đã đi xa hơn minMove kể từ keyframe trước (UE đứng yên chỉ ghi một lần)
+    void Sample() {
+        PROFILE_SCOPE("AnimationRecorder::Sample");
+        float t = Simulator::Now().GetSeconds();
+        for (uint32_t id = 0; id < m_nodes.size(); ++id) {
+            Node& n = m_nodes[id];
+            Vector p = n.mobility->GetPosition();
+            if (n.written && CalculateDistance(p, n.last) < m_minMove) continue;
+            n.last = p; n.written = true;
+            if (m_binary) { uint8_t type = 1; float x = p.x, y = p.y, z = p.z; Put(type); Put(t); Put(id); Put(x); Put(y); Put(z); }
+            else Text("P,%.2f,%u,%.1f,%.1f,%.1f\n", t, id, p.x, p.y, p.z);
+        }
+    }
+
+    void OnCellChange(uint32_t ueIndex, uint16_t cellId) {
+        if (!m_file) return;
+        float t = Simulator::Now().GetSeconds();
+        uint32_t id = m_uavCount + ueIndex;
+        if (m_binary) { uint8_t type = 2; Put(type); Put(t); Put(id); Put(cellId); }
+        else Text("C,%.3f,%u,%u\n", t, id, cellId);
+    }
+
+    void Close() {
+        if (!m_file) return;
+        Flush();
+        if (m_gzip) ::pclose(m_file); else std::fclose(m_file);
+        m_file = nullptr;
+        m_nodes.clear();
+    }
+
+    bool IsOpen() const { return m_file != nullptr; }
+
+private:
+    struct Node { Ptr<MobilityModel> mobility; Vector last; bool written; };
+
+    template <typename T> void Put(const T& v) { Append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+    void Text(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char line[128];
+        va_list args; va_start(args, fmt);
+        int n = std::vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        if (n > 0) Append(line, std::min<size_t>(n, sizeof(line) - 1));
+    }
+    // Gom buffer rồi fwrite một lần cho mỗi 64 KB
+    void Append(const char* data, size_t n) {
+        m_buffer.append(data, n);
+        if (m_buffer.size() >= 65536) Flush();
+    }
+    void Flush() {
+        if (!m_buffer.empty()) std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+
+    std::FILE* m_file = nullptr;
+    bool m_binary = false, m_gzip = false;
+    double m_minMove = 0.5;
+    uint32_t m_uavCount = 0;
+    std::vector<Node> m_nodes;
+    std::string m_buffer;
+};
+
+AnimationRecorder animRecorder;
+
 void UpdateUeColor(uint32_t ueIndex, uint16_t cellId) {
+    PROFILE_SCOPE("UpdateUeColor");
+    animRecorder.OnCellChange(ueIndex, cellId);
     if (pAnim && ueIndex < globalUeNodes.GetN()) {
         uint8_t r=0, g=0, b=0;
-        if (cellId == 1) { r=255; g=0; b=0; }      
-        else if (cellId == 2) { r=0; g=255; b=0; } 
-        else if (cellId == 3) { r=128; g=0; b=128; }
-        else { r=100; g=100; b=100; } // Unknown cell
+        CellColor(cellId, r, g, b);
         pAnim->UpdateNodeColor(globalUeNodes.Get(ueIndex), r, g, b);
         pAnim->UpdateNodeDescription(globalUeNodes.Get(ueIndex), "UE-" + std::to_string(ueIndex+1) + " (C" + std::to_string(cellId) + ")");
     }
 }
 
-// ==================== MEC LOGIC  ====================
-void GenerateMecTask(uint32_t ueId) {
-    double time = Simulator::Now().GetSeconds();
-    double dataSize = 0.1; // Mbits
-    double cpuCycles = 2000.0; // Megacycles
-    
-    // Lấy throughput hiện tại
-    double thpt = lastThroughput[ueId];
-    if (thpt < 0.1) thpt = 5.0; 
-    
-    // Tính toán thời gian truyền và xử lý cơ bản
-    double txTime = (dataSize * 8.0) / thpt;
-    double uavCpuSpeed = 5000.0; // Cycles/s
-    double procTime = cpuCycles / uavCpuSpeed;
-    
-    // Tính toán Migration Penalty
-    double migrationPenalty = 0.0;
-    uint16_t currentCell = ueCurrentCellMap[ueId];
-    uint16_t prevCell = uePreviousMecCellMap[ueId];
+// ==================== MEC COMPUTE ENGINE ====================
+// Mỗi UAV eNB có một MEC server: nhiều core, một hàng đợi task (FIFO / EDF / priority).
+// Input/output của task được truyền thật qua bearer LTE (UDP, chia chunk) giữa UE và
+// mecHost. EPC của ns-3 không tách user-plane tại eNB nên dữ liệu vẫn đi qua core,
+// nhưng task được xếp vào hàng đợi của UAV đang phục vụ UE lúc upload xong.
+enum class QueueDiscipline { FIFO, EDF, PRIORITY };
+
+struct MecConfig {
+    uint32_t cores = 1;
+    double clockMHz = 5000.0;        // Mcycles/s mỗi core (UAV CPU cũ = 5000)
+    std::string discipline = "fifo"; // fifo | edf | priority
+    uint32_t inputBytes = 12500;     // 0.1 Mbit như cũ
+    uint32_t outputBytes = 1250;
+    double mcycles = 2000.0;
+    double localClockMHz = 1000.0;   // CPU của UE
+    double interval = 2.0;           // s, khoảng cách trung bình giữa 2 task của một UE
+    std::string arrival = "periodic";// periodic | poisson
+    double deadline = 2.0;           // s tính từ lúc sinh task (EDF, DeadlineMet)
+    double timeout = 10.0;           // s, quá hạn này task offload bị coi là mất
+    uint32_t priorityClasses = 3;    // priority = (UE_ID - 1) % classes, 0 là ưu tiên nhất
+    // Quyết định offload và mô hình năng lượng
+    std::string policy = "queue";    // threshold | queue | partial
+    std::string predictor = "last";  // last | ewma | regression: throughput upload dự đoán
+    double thresholdMbps = 1.0;      // threshold: offload khi throughput dự đoán >= ngưỡng
+    double energyWeight = 0.0;       // cost = (1-w)*latency/local + w*energy/local (0 = chỉ latency)
+    uint32_t predictorWindow = 10;   // số mẫu 100 ms gần nhất cho ewma / regression
+    double ewmaAlpha = 0.3;
+    double ueKappa = 1e-27;          // J/(cycle*Hz^2): năng lượng CPU = kappa * cycles * f^2
+    double uavKappa = 1e-28;         // như trên, cho core MEC của UAV
+    double ueTxPowerW = 0.5;         // W, UE khi upload input
+    double ueRxPowerW = 0.2;         // W, UE khi nhận output
+    // Service migration: container của UE đi theo UE qua X2 giữa các UAV
+    std::string migration = "reactive"; // flat (phạt cố định 50 ms) | reactive | proactive
+    uint32_t stateBytes = 8000000;   // state của một container
+    double dirtyFraction = 0.1;      // phần state bị ghi lại sau pre-copy, gửi lúc chuyển hẳn
+    double precopyMarginDb = 3.0;    // pre-copy khi RSRP neighbour cách serving < margin và đang tăng
+    double x2RateMbps = 10000.0;     // băng thông link X2 giữa 2 UAV (mặc định ns-3: 10 Gb/s)
+    double x2DelayMs = 0.0;          // mặc định ns-3: không trễ
+};
 
-    // Nếu Cell thay đổi so với lần tính trước -> Đã có Handover -> Phạt thời gian di trú
-    if (prevCell != 0 && currentCell != 0 && currentCell != prevCell) {
-        migrationPenalty = 0.050; // Phạt 50ms cho việc di chuyển container giữa các UAV
-        // Ghi log sự kiện di trú
-        std::cout << "   [MEC MIGRATION] Time: " << time << "s | UE" << ueId 
-                  << " migrating data C" << prevCell << " -> C" << currentCell 
-                  << " (+50ms delay)" << std::endl;
+MecConfig mecCfg;
+const uint16_t kMecServerPort = 5000;
+const uint16_t kMecClientPort = 5001;
+const uint32_t kMecChunkBytes = 1400;
+
+// Header đầu mỗi chunk: task nào, message dài bao nhiêu byte
+class MecTaskHeader : public Header {
+public:
+    static TypeId GetTypeId() {
+        static TypeId tid = TypeId("MecTaskHeader").SetParent<Header>().AddConstructor<MecTaskHeader>();
+        return tid;
     }
-    
-    // Cập nhật lại Cell đã xử lý
-    uePreviousMecCellMap[ueId] = currentCell;
+    TypeId GetInstanceTypeId() const override { return GetTypeId(); }
+    uint32_t GetSerializedSize() const override { return 8; }
+    void Serialize(Buffer::Iterator start) const override { start.WriteHtonU32(m_taskId); start.WriteHtonU32(m_messageBytes); }
+    uint32_t Deserialize(Buffer::Iterator start) override { m_taskId = start.ReadNtohU32(); m_messageBytes = start.ReadNtohU32(); return 8; }
+    void Print(std::ostream& os) const override { os << "task=" << m_taskId << " bytes=" << m_messageBytes; }
+    uint32_t m_taskId = 0;
+    uint32_t m_messageBytes = 0;
+};
+NS_OBJECT_ENSURE_REGISTERED(MecTaskHeader);
 
-    // Tổng độ trễ Offload
-    double totalLatency = txTime + procTime + migrationPenalty;
-    
-    // Độ trễ xử lý tại chỗ (Local)
-    double localTime = cpuCycles / 1000.0; // Local CPU yếu hơn (1000)
-    
-    // Quyết định Offload
-    bool offloaded = totalLatency < localTime;
-    double finalLatency = offloaded ? totalLatency : localTime;
-    
-    offloadTasks.push_back({taskCounter++, finalLatency, offloaded, 0.0});
-    
-    // Ghi file CSV: Thêm MigrationPenalty 
-    mecOffloadFile << time << "," << ueId << "," << taskCounter << ","
-                   << (offloaded ? "UAV-MEC" : "Local") << ","
-                   << finalLatency << "," << thpt << "," << migrationPenalty << std::endl;
-}
+struct MecTask {
+    uint32_t taskId; UeState* ue;
+    double created = 0, uploaded = -1, arrived = -1, started = -1, finished = -1, completed = -1;
+    double deadline = 0; uint8_t priority = 0;
+    uint16_t cellId = 0; double migrationPenalty = 0; double thptSample = 0;
+    double fraction = 0;             // phần task offload (1 = toàn bộ, partial: 0 < f < 1)
+    uint32_t inputBytes = 0; double mcycles = 0;   // phần gửi lên UAV
+    double localFinish = 0;          // phần chạy trên UE xong lúc này (song song với phần offload)
+    double predLatency = 0, predEnergy = 0, decisionNs = 0;
+    uint32_t rxInputBytes = 0, rxOutputBytes = 0;
+    bool done = false;
+};
 
-// ==================== HANDOVER CALLBACKS ====================
-bool IsPingPongHandover(uint64_t imsi, uint16_t targetCellId) {
-    if (ueHandoverHistory[imsi].size() < 2) return false;
-    auto& history = ueHandoverHistory[imsi];
-    return (history[history.size()-1] == targetCellId || history[history.size()-2] == targetCellId);
-}
+std::vector<MecTask> mecTasks;   // index = taskId
+uint32_t mecTasksFailed = 0;
 
-void NotifyHandoverStartUe(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId) {   
-    handoverStartCount++;
-    HandoverEvent event; event.time = Simulator::Now().GetSeconds();
-    event.imsi = imsi; event.sourceCellId = cellId; event.targetCellId = targetCellId;
-    event.throughputBefore = lastThroughput[imsi];
-    lastHandoverEvent[imsi] = event;
-}
+// Năng lượng CPU động (J): kappa * cycles * f^2
+double CpuEnergy(double kappa, double mcycles, double clockMHz) { return kappa * mcycles * 1e6 * std::pow(clockMHz * 1e6, 2); }
 
-void NotifyHandoverEndOkUe(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
-    handoverCount++;
-    double time = Simulator::Now().GetSeconds();
-    
-    // Cập nhật bản đồ vị trí ngay lập tức để MEC biết
-    ueCurrentCellMap[imsi] = cellId; 
+void SendMecOutput(uint32_t taskId);
+void RequestMecService(uint32_t taskId);
+double EstimateMigrationDelay(const UeState& ue);
+bool RadioIsAbstract();
+double RadioTransferTime(const UeState& ue, uint32_t bytes);
+
+class MecServer {
+public:
+    void Configure(uint16_t cellId, uint32_t cores, double clockMHz, QueueDiscipline discipline) {
+        m_cellId = cellId; m_cores = cores; m_clockMHz = clockMHz; m_discipline = discipline;
+    }
+
+    void Submit(uint32_t taskId) {
+        PROFILE_SCOPE("MecServer::Submit");
+        MecTask& task = mecTasks[taskId];
+        task.arrived = Simulator::Now().GetSeconds();
+        task.cellId = m_cellId;
+        double key = task.arrived;
+        if (m_discipline == QueueDiscipline::EDF) key = task.deadline;
+        else if (m_discipline == QueueDiscipline::PRIORITY) key = task.priority;
+        m_queue.push_back({key, m_seq++, taskId});
+        std::push_heap(m_queue.begin(), m_queue.end(), Later);
+        m_queuedMcycles += task.mcycles;
+        m_maxQueue = std::max<uint32_t>(m_maxQueue, m_queue.size());
+        StartNext();
+    }
+
+    // Thời gian chờ ước lượng nếu task mới đến bây giờ (dùng cho quyết định offload): phần service
+    // còn lại của các core đang bận cộng toàn bộ hàng đợi, chia đều cho các core
+    double EstimatedWait() const {
+        if (m_busy < m_cores) return 0.0;
+        double remaining = std::max(0.0, m_busyEndSum - m_busy * Simulator::Now().GetSeconds());
+        return (remaining + m_queuedMcycles / m_clockMHz) / m_cores;
+    }
+
+    double Utilisation(double elapsed) const { return elapsed > 0 ? m_busyTime / (elapsed * m_cores) : 0.0; }
+    uint16_t m_cellId = 0;
+    uint32_t m_cores = 1;
+    double m_clockMHz = 5000.0;
+    uint32_t m_served = 0, m_maxQueue = 0;
+    double m_busyTime = 0.0, m_queueDelaySum = 0.0, m_queueDelayMax = 0.0;
+    double m_energyJ = 0.0;          // năng lượng CPU đã tiêu cho các task
+
+private:
+    struct Entry { double key; uint64_t seq; uint32_t taskId; };
+    static bool Later(const Entry& a, const Entry& b) { return a.key != b.key ? a.key > b.key : a.seq > b.seq; }
+
+    void StartNext() {
+        while (m_busy < m_cores && !m_queue.empty()) {
+            std::pop_heap(m_queue.begin(), m_queue.end(), Later);
+            uint32_t taskId = m_queue.back().taskId;
+            m_queue.pop_back();
+            MecTask& task = mecTasks[taskId];
+            m_queuedMcycles -= task.mcycles;
+            task.started = Simulator::Now().GetSeconds();
+            double wait = task.started - task.arrived;
+            m_queueDelaySum += wait; m_queueDelayMax = std::max(m_queueDelayMax, wait);
+            double service = task.mcycles / m_clockMHz;
+            m_busy++;
+            m_busyEndSum += task.started + service;
+            Simulator::Schedule(Seconds(service), &MecServer::Finish, this, taskId, service);
+        }
+    }
+
+    void Finish(uint32_t taskId, double service) {
+        PROFILE_SCOPE("MecServer::Finish");
+        m_busy--; m_served++; m_busyTime += service;
+        m_busyEndSum = m_busy ? m_busyEndSum - Simulator::Now().GetSeconds() : 0.0;
+        m_energyJ += CpuEnergy(mecCfg.uavKappa, mecTasks[taskId].mcycles, m_clockMHz);
+        mecTasks[taskId].finished = Simulator::Now().GetSeconds();
+        SendMecOutput(taskId);
+        StartNext();
+    }
+
+    QueueDiscipline m_discipline = QueueDiscipline::FIFO;
+    uint32_t m_busy = 0;
+    uint64_t m_seq = 0;
+    double m_queuedMcycles = 0.0;
+    double m_busyEndSum = 0.0;    // tổng thời điểm xong của các task đang chạy
+    std::vector<Entry> m_queue;   // min-heap theo (key, seq)
+};
+
+std::vector<MecServer> mecServers;   // index = cellId - 1
+Ptr<Socket> mecHostSocket;
+std::vector<Ptr<Socket>> ueMecSockets;        // index = slot
+std::vector<Ipv4Address> ueAddresses;         // index = slot
+Ipv4Address mecHostAddress;
+
+void SendChunks(Ptr<Socket> socket, const Address& dest, uint32_t taskId, uint32_t bytes) {
+    MecTaskHeader hdr; hdr.m_taskId = taskId; hdr.m_messageBytes = bytes;
+    for (uint32_t sent = 0; sent < bytes; sent += kMecChunkBytes) {
+        Ptr<Packet> p = Create<Packet>(std::min(kMecChunkBytes, bytes - sent));
+        p->AddHeader(hdr);
+        socket->SendTo(p, 0, dest);
+    }
+}
+
+// Input đã tới mecHost đủ: task vào hàng đợi của UAV đang phục vụ UE
+void MecInputComplete(uint32_t taskId) {
+    MecTask& task = mecTasks[taskId];
+    if (task.uploaded >= 0) return;
+    task.uploaded = Simulator::Now().GetSeconds();
+    // Container phải có mặt ở UAV đang phục vụ UE trước khi task vào hàng đợi
+    RequestMecService(taskId);
+}
+
+void MecHostReceive(Ptr<Socket> socket) {
+    PROFILE_SCOPE("MecHostReceive");
+    Address from;
+    while (Ptr<Packet> p = socket->RecvFrom(from)) {
+        MecTaskHeader hdr;
+        p->RemoveHeader(hdr);
+        if (hdr.m_taskId >= mecTasks.size()) continue;
+        MecTask& task = mecTasks[hdr.m_taskId];
+        task.rxInputBytes += p->GetSize();
+        if (task.rxInputBytes >= hdr.m_messageBytes) MecInputComplete(hdr.m_taskId);
+    }
+}
+
+void MecOutputComplete(uint32_t taskId);
+
+// Radio abstract: không có socket, thời gian truyền tính từ throughput hiện tại của UE
+void SendMecOutput(uint32_t taskId) {
+    MecTask& task = mecTasks[taskId];
+    if (RadioIsAbstract()) Simulator::Schedule(Seconds(RadioTransferTime(*task.ue, mecCfg.outputBytes)), &MecOutputComplete, taskId);
+    else SendChunks(mecHostSocket, InetSocketAddress(ueAddresses[task.ue->ueId - 1], kMecClientPort), taskId, mecCfg.outputBytes);
+}
+
+// ==================== OFFLOAD POLICY ====================
+// Quyết định offload của mọi UE đi qua một OffloadPolicy (--offloadPolicy); throughput upload lấy
+// từ bộ dự đoán (--throughputPredictor) trên các mẫu 100 ms gần nhất của UE.
+//  - threshold: offload toàn bộ khi throughput dự đoán >= offloadThreshold Mb/s
+//  - queue: offload toàn bộ khi cost dự đoán (gồm chờ hàng đợi UAV và migration) thấp hơn chạy local
+//  - partial: offload phần f = 0, 0.1, ..., 1 của task có cost thấp nhất, phần còn lại chạy song song trên UE
+// cost = (1-w)*latency/latency_local + w*energy/energy_local, w = energyWeight.
+// Năng lượng UE = CPU (kappa*cycles*f^2) + ueTxPowerW khi upload + ueRxPowerW khi nhận output.
+// Thời gian ra quyết định (dự đoán + policy) luôn được đo, không phụ thuộc --profile.
+enum class ThroughputPredictor { LAST, EWMA, REGRESSION };
+
+struct OffloadEstimate { double fraction = 0.0, latency = 0.0, energy = 0.0, cost = 0.0; };
+
+// Đầu vào chung của mọi policy cho task của một UE
+struct OffloadContext {
+    double thpt = 5.0;        // Mb/s dự đoán cho upload / download
+    double wait = 0.0;        // s, chờ hàng đợi ước lượng ở UAV đang phục vụ
+    double migration = 0.0;   // s, chờ container tới UAV
+    double localLatency = 0.0, localEnergy = 0.0;
+
+    OffloadEstimate Estimate(double fraction) const {
+        OffloadEstimate e;
+        e.fraction = fraction;
+        e.latency = (1.0 - fraction) * mecCfg.mcycles / mecCfg.localClockMHz;
+        e.energy = CpuEnergy(mecCfg.ueKappa, (1.0 - fraction) * mecCfg.mcycles, mecCfg.localClockMHz);
+        if (fraction > 0.0) {
+            double up = fraction * mecCfg.inputBytes * 8.0 / 1e6 / thpt, down = mecCfg.outputBytes * 8.0 / 1e6 / thpt;
+            e.latency = std::max(e.latency, up + wait + fraction * mecCfg.mcycles / mecCfg.clockMHz + migration + down);
+            e.energy += mecCfg.ueTxPowerW * up + mecCfg.ueRxPowerW * down;
+        }
+        double w = mecCfg.energyWeight;
+        // w = 0 hoặc năng lượng local không dương: chỉ so latency (tránh 0/0 ra NaN)
+        e.cost = (1.0 - w) * e.latency / localLatency;
+        if (w > 0.0 && localEnergy > 0.0) e.cost += w * e.energy / localEnergy;
+        return e;
+    }
+};
+
+class OffloadPolicy {
+public:
+    virtual ~OffloadPolicy() {}
+    virtual OffloadEstimate Decide(const OffloadContext& ctx) const = 0;
+};
+
+class ThresholdPolicy : public OffloadPolicy {
+public:
+    OffloadEstimate Decide(const OffloadContext& ctx) const override {
+        return ctx.Estimate(ctx.thpt >= mecCfg.thresholdMbps ? 1.0 : 0.0);
+    }
+};
+
+class QueueAwarePolicy : public OffloadPolicy {
+public:
+    OffloadEstimate Decide(const OffloadContext& ctx) const override {
+        OffloadEstimate remote = ctx.Estimate(1.0), local = ctx.Estimate(0.0);
+        return remote.cost < local.cost ? remote : local;
+    }
+};
+
+class PartialPolicy : public OffloadPolicy {
+public:
+    OffloadEstimate Decide(const OffloadContext& ctx) const override {
+        OffloadEstimate best = ctx.Estimate(0.0);
+        for (uint32_t k = 1; k <= 10; ++k) {
+            OffloadEstimate e = ctx.Estimate(k / 10.0);
+            if (e.cost < best.cost) best = e;
+        }
+        return best;
+    }
+};
+
+std::unique_ptr<OffloadPolicy> offloadPolicy;
+ThroughputPredictor throughputPredictor = ThroughputPredictor::LAST;
+
+void ConfigureOffloadPolicy(const MecConfig& cfg) {
+    if (cfg.policy == "threshold") offloadPolicy.reset(new ThresholdPolicy());
+    else if (cfg.policy == "queue") offloadPolicy.reset(new QueueAwarePolicy());
+    else if (cfg.policy == "partial") offloadPolicy.reset(new PartialPolicy());
+    else NS_ABORT_MSG("Unknown offloadPolicy " << cfg.policy);
+    if (cfg.predictor == "last") throughputPredictor = ThroughputPredictor::LAST;
+    else if (cfg.predictor == "ewma") throughputPredictor = ThroughputPredictor::EWMA;
+    else if (cfg.predictor == "regression") throughputPredictor = ThroughputPredictor::REGRESSION;
+    else NS_ABORT_MSG("Unknown throughputPredictor " << cfg.predictor);
+    NS_ABORT_MSG_IF(cfg.energyWeight < 0.0 || cfg.energyWeight > 1.0, "energyWeight must be in [0, 1]");
+}
+
+// Throughput (Mb/s) dự đoán cho lần truyền sắp tới. Chưa có mẫu nào (trước khi traffic chạy) thì 5 Mb/s.
+double PredictThroughput(const UeState& ue) {
+    uint32_t n = std::min(ue.thptHistory.Size(), std::max(1u, mecCfg.predictorWindow));
+    if (throughputPredictor == ThroughputPredictor::LAST || n < 2) return ue.lastThroughput < 0.1 ? 5.0 : ue.lastThroughput;
+    double estimate = 0.0;
+    if (throughputPredictor == ThroughputPredictor::EWMA) {
+        estimate = ue.thptHistory.Recent(n - 1);
+        for (uint32_t k = n - 1; k-- > 0;) estimate = mecCfg.ewmaAlpha * ue.thptHistory.Recent(k) + (1.0 - mecCfg.ewmaAlpha) * estimate;
+    } else {
+        // Hồi quy tuyến tính theo thứ tự mẫu (x = -k cho mẫu thứ k gần nhất), ngoại suy một mẫu về phía trước
+        double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+        for (uint32_t k = 0; k < n; ++k) {
+            double x = -(double)k, y = ue.thptHistory.Recent(k);
+            sx += x; sy += y; sxx += x * x; sxy += x * y;
+        }
+        double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        estimate = (sy - slope * sx) / n + slope;
+    }
+    return std::max(0.1, estimate);
+}
+
+// Chi phí ra quyết định và sai số dự đoán so với kết quả thật
+struct OffloadPolicyStats {
+    uint64_t decisions = 0, offloaded = 0, partial = 0;
+    LogHistogram decisionNs;
+    uint64_t compared = 0;
+    double latencyErrorSum = 0.0, energyErrorSum = 0.0;   // |dự đoán - thật|
+
+    void Print(std::ostream& os) const {
+        if (decisions == 0) return;
+        os << "Offload policy: " << mecCfg.policy << " (predictor " << mecCfg.predictor << ", energy weight "
+           << mecCfg.energyWeight << ") | " << decisions << " decisions, offloaded " << offloaded << " (partial "
+           << partial << ") | decision cost mean " << decisionNs.Mean() << " ns, p99 " << decisionNs.ValueAt(99) << " ns";
+        if (compared) os << " | prediction error mean " << latencyErrorSum / compared * 1000.0 << " ms, "
+                         << energyErrorSum / compared << " J";
+        os << std::endl;
+    }
+};
+
+OffloadPolicyStats offloadPolicyStats;
+
+void RecordMecTask(const MecTask& task, bool offloaded, double latency, double energy) {
+    offloadTasks.push_back({task.taskId, latency, offloaded, energy});
+    kpiStats.Record(KPI_MEC_LATENCY, task.ue->ueId - 1, offloaded ? task.cellId : task.ue->currentCell, latency * 1000.0);
+    mecOffloadFile.Write({task.created, task.ue->ueId, task.taskId + 1, offloaded, latency, task.thptSample, task.migrationPenalty});
+    offloadDecisionFile.Write({task.created, task.ue->ueId, task.taskId + 1, task.fraction, task.thptSample,
+                               task.predLatency, task.predEnergy, latency, energy, task.decisionNs});
+    offloadPolicyStats.compared++;
+    offloadPolicyStats.latencyErrorSum += std::fabs(task.predLatency - latency);
+    offloadPolicyStats.energyErrorSum += std::fabs(task.predEnergy - energy);
+}
+
+// UE nhận đủ output: task hoàn tất (partial: khi phần chạy trên UE cũng đã xong)
+void MecOutputComplete(uint32_t taskId) {
+    MecTask& task = mecTasks[taskId];
+    if (task.done) return;
+    task.done = true;
+    double received = Simulator::Now().GetSeconds();
+    task.completed = std::max(received, task.localFinish);
+    double latency = task.completed - task.created;
+    double energy = CpuEnergy(mecCfg.ueKappa, (1.0 - task.fraction) * mecCfg.mcycles, mecCfg.localClockMHz) +
+                    mecCfg.ueTxPowerW * (task.uploaded - task.created) + mecCfg.ueRxPowerW * (received - task.finished);
+    RecordMecTask(task, true, latency, energy);
+    mecTaskFile.Write({task.created, task.ue->ueId, task.taskId + 1, task.cellId,
+                       task.uploaded - task.created, task.started - task.arrived, task.finished - task.started,
+                       received - task.finished, latency, task.completed <= task.deadline});
+}
+
+void UeMecReceive(Ptr<Socket> socket) {
+    PROFILE_SCOPE("UeMecReceive");
+    Address from;
+    while (Ptr<Packet> p = socket->RecvFrom(from)) {
+        MecTaskHeader hdr;
+        p->RemoveHeader(hdr);
+        if (hdr.m_taskId >= mecTasks.size()) continue;
+        MecTask& task = mecTasks[hdr.m_taskId];
+        task.rxOutputBytes += p->GetSize();
+        if (task.rxOutputBytes >= hdr.m_messageBytes) MecOutputComplete(hdr.m_taskId);
+    }
+}
+
+void MecTaskTimeout(uint32_t taskId) {
+    PROFILE_SCOPE("MecTaskTimeout");
+    MecTask& task = mecTasks[taskId];
+    if (task.done) return;
+    task.done = true;
+    mecTasksFailed++;
+    // Task mất vẫn tính vào KPI latency, ở giá trị timeout (cận dưới): bỏ đi thì mean / p95 đẹp
+    // lên đúng lúc mạng tệ nhất. Năng lượng: phần chạy local + thời gian UE đã phát input
+    double now = Simulator::Now().GetSeconds();
+    double energy = CpuEnergy(mecCfg.ueKappa, (1.0 - task.fraction) * mecCfg.mcycles, mecCfg.localClockMHz) +
+                    mecCfg.ueTxPowerW * ((task.uploaded >= 0 ? task.uploaded : now) - task.created);
+    offloadTasks.push_back({task.taskId, mecCfg.timeout, true, energy});
+    kpiStats.Record(KPI_MEC_LATENCY, task.ue->ueId - 1, task.cellId ? task.cellId : task.ue->currentCell, mecCfg.timeout * 1000.0);
+    mecTaskFile.Write({task.created, task.ue->ueId, task.taskId + 1, task.cellId, -1, -1, -1, -1, -1, false});
+    offloadDecisionFile.Write({task.created, task.ue->ueId, task.taskId + 1, task.fraction, task.thptSample,
+                               task.predLatency, task.predEnergy, -1, -1, task.decisionNs});
+}
+
+void GenerateMecTask(UeState& ue) {
+    PROFILE_SCOPE("GenerateMecTask");
+    uint32_t ueId = ue.ueId;
+    double time = Simulator::Now().GetSeconds();
+    
+    MecTask task;
+    task.taskId = mecTasks.size(); task.ue = &ue;
+    task.created = time; task.deadline = time + mecCfg.deadline;
+    task.priority = (ueId - 1) % std::max(1u, mecCfg.priorityClasses);
+    
+    uint16_t currentCell = ue.currentCell;
+
+    // Quyết định Offload: dự đoán throughput + ước lượng chờ hàng đợi / migration + policy, đo cả thời gian
+    auto t0 = std::chrono::steady_clock::now();
+    OffloadContext ctx;
+    ctx.thpt = PredictThroughput(ue);
+    ctx.wait = (currentCell > 0 && currentCell <= mecServers.size()) ? mecServers[currentCell - 1].EstimatedWait() : 0.0;
+    ctx.migration = EstimateMigrationDelay(ue);
+    ctx.localLatency = mecCfg.mcycles / mecCfg.localClockMHz;
+    ctx.localEnergy = CpuEnergy(mecCfg.ueKappa, mecCfg.mcycles, mecCfg.localClockMHz);
+    // Chưa gắn cell nào thì chỉ chạy local được
+    OffloadEstimate decision = currentCell != 0 ? offloadPolicy->Decide(ctx) : ctx.Estimate(0.0);
+    task.decisionNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    offloadPolicyStats.decisions++;
+    offloadPolicyStats.decisionNs.Record((uint64_t)task.decisionNs);
+
+    task.thptSample = ctx.thpt;
+    task.fraction = decision.fraction;
+    task.predLatency = decision.latency;
+    task.predEnergy = decision.energy;
+    task.inputBytes = std::max<uint32_t>(1, std::lround(decision.fraction * mecCfg.inputBytes));
+    task.mcycles = decision.fraction * mecCfg.mcycles;
+    task.localFinish = time + (1.0 - decision.fraction) * mecCfg.mcycles / mecCfg.localClockMHz;
+    mecTasks.push_back(task);
+    if (decision.fraction <= 0.0) {
+        RecordMecTask(mecTasks.back(), false, decision.latency, decision.energy);
+        mecTasks.back().done = true;
+        return;
+    }
+    offloadPolicyStats.offloaded++;
+    if (decision.fraction < 1.0) offloadPolicyStats.partial++;
+    if (RadioIsAbstract()) Simulator::Schedule(Seconds(RadioTransferTime(ue, task.inputBytes)), &MecInputComplete, task.taskId);
+    else SendChunks(ueMecSockets[ueId - 1], InetSocketAddress(mecHostAddress, kMecServerPort), task.taskId, task.inputBytes);
+    Simulator::Schedule(Seconds(mecCfg.timeout), &MecTaskTimeout, task.taskId);
+}
+
+// Poisson: mỗi UE luôn chỉ có một event "task kế tiếp" trong scheduler
+void PoissonMecArrival(UeState* ue, Ptr<ExponentialRandomVariable> gap, double stopTime) {
+    GenerateMecTask(*ue);
+    double next = Simulator::Now().GetSeconds() + gap->GetValue();
+    if (next < stopTime) Simulator::Schedule(Seconds(next) - Simulator::Now(), &PoissonMecArrival, ue, gap, stopTime);
+}
+
+// ==================== SERVICE MIGRATION ====================
+// Container (state) phục vụ mỗi UE chạy trên một UAV. Khi UE đổi cell, state được gửi thật
+// qua link X2 point-to-point mà AddX2Interface tạo ra (UDP, chia chunk, pacing theo băng
+// thông link; nhiều transfer trên cùng link chia nhau round-robin). Hai cell không có X2
+// trực tiếp thì state đi store-and-forward qua các UAV trung gian.
+//  - flat:      phạt cố định 50 ms như bản gốc, không truyền gì
+//  - reactive:  task đầu tiên ở cell mới mới kích hoạt chuyển toàn bộ state, task phải chờ
+//  - proactive: pre-copy toàn bộ state sang cell đích dự đoán (RSRP neighbour tăng dần và đã
+//               gần serving, hoặc HandoverStart); sau handover chỉ còn gửi phần dirty
+enum class MigrationMode { FLAT, REACTIVE, PROACTIVE };
+enum MigrationKind : uint8_t { kMigrateFull = 0, kMigratePreCopy = 1, kMigrateDelta = 2 };
+const uint16_t kMigrationPort = 5002;
+const uint32_t kMigrationOverheadBytes = 38;   // MecTaskHeader + UDP + IPv4 + PPP
+
+class MigrationManager {
+public:
+    void Install(const NodeContainer& enbNodes, uint32_t numUes, const MecConfig& cfg) {
+        Reconfigure(cfg);
+        m_rateBps = cfg.x2RateMbps * 1e6;
+        m_delay = cfg.x2DelayMs / 1000.0;
+        m_ues.assign(numUes, UeContainer());
+        m_neighbours.assign(enbNodes.GetN() + 1, std::vector<uint16_t>());
+        // Radio abstract: UAV không có IP stack / X2, mọi transfer đi đường giải tích (TransferTime)
+        if (enbNodes.GetN() == 0 || !enbNodes.Get(0)->GetObject<Ipv4>()) return;
+
+        // Tìm các link X2: device point-to-point mà đầu kia cũng là một UAV eNB (S1 thì đầu kia là SGW)
+        std::map<uint32_t, uint16_t> cellOfNode;
+        for (uint32_t i = 0; i < enbNodes.GetN(); ++i) cellOfNode[enbNodes.Get(i)->GetId()] = i + 1;
+        for (uint32_t i = 0; i < enbNodes.GetN(); ++i) {
+            Ptr<Node> node = enbNodes.Get(i);
+            Ptr<Socket> sock = Socket::CreateSocket(node, UdpSocketFactory::GetTypeId());
+            sock->Bind(InetSocketAddress(Ipv4Address::GetAny(), kMigrationPort));
+            sock->SetRecvCallback(MakeCallback(&MigrationManager::Receive, this));
+            m_sockets.push_back(sock);
+            for (uint32_t d = 0; d < node->GetNDevices(); ++d) {
+                Ptr<PointToPointNetDevice> dev = DynamicCast<PointToPointNetDevice>(node->GetDevice(d));
+                if (!dev) continue;
+                Ptr<Channel> channel = dev->GetChannel();
+                for (std::size_t k = 0; k < channel->GetNDevices(); ++k) {
+                    Ptr<NetDevice> peerDev = channel->GetDevice(k);
+                    auto peer = cellOfNode.find(peerDev->GetNode()->GetId());
+                    if (peer == cellOfNode.end() || peer->second == i + 1) continue;
+                    Ptr<Ipv4> ipv4 = peerDev->GetNode()->GetObject<Ipv4>();
+                    m_links[LinkKey(i + 1, peer->second)].peer = ipv4->GetAddress(ipv4->GetInterfaceForDevice(peerDev), 0).GetLocal();
+                    m_neighbours[i + 1].push_back(peer->second);
+                }
+            }
+        }
+    }
+
+    // Mode và kích thước state của run; link X2 (tốc độ, delay) giữ như lúc Install
+    void Reconfigure(const MecConfig& cfg) {
+        if (cfg.migration == "flat") m_mode = MigrationMode::FLAT;
+        else if (cfg.migration == "proactive") m_mode = MigrationMode::PROACTIVE;
+        else NS_ABORT_MSG_IF(cfg.migration != "reactive", "Unknown migration mode " << cfg.migration);
+        m_cfg = cfg;
+    }
+
+    void OnConnected(const UeState& ue, uint16_t cellId) {
+        UeContainer& c = m_ues[ue.ueId - 1];
+        if (c.serviceCell == 0) c.serviceCell = cellId;
+    }
+
+    // Task upload xong: vào hàng đợi ngay nếu container đã ở cell hiện tại, không thì chờ migration
+    void RequestService(uint32_t taskId) {
+        MecTask& task = mecTasks[taskId];
+        uint32_t slot = task.ue->ueId - 1;
+        uint16_t cell = task.ue->currentCell;
+        if (cell == 0 || cell > mecServers.size()) return;
+        UeContainer& c = m_ues[slot];
+        if (c.serviceCell == 0) c.serviceCell = cell;
+        if (m_mode == MigrationMode::FLAT) {
+            if (c.serviceCell != cell) {
+                task.migrationPenalty = 0.050; // Phạt 50ms cho việc di chuyển container giữa các UAV
+                std::cout << "   [MEC MIGRATION] Time: " << Simulator::Now().GetSeconds() << "s | UE" << slot + 1
+                          << " migrating data C" << c.serviceCell << " -> C" << cell << " (+50ms delay)" << std::endl;
+                c.serviceCell = cell;
+            }
+            Simulator::Schedule(Seconds(task.migrationPenalty), &MecServer::Submit, &mecServers[cell - 1], taskId);
+            return;
+        }
+        if (c.serviceCell == cell && c.switchTarget == 0) {
+            task.migrationPenalty = Simulator::Now().GetSeconds() - task.uploaded;
+            mecServers[cell - 1].Submit(taskId);
+            return;
+        }
+        c.waiting.push_back(taskId);
+        SwitchTo(slot, cell);
+    }
+
+    // Thời gian chờ container ước lượng nếu UE offload bây giờ (dùng cho quyết định offload)
+    double EstimateDelay(const UeState& ue) const {
+        if (m_ues.empty()) return 0.0;
+        const UeContainer& c = m_ues[ue.ueId - 1];
+        uint16_t cell = ue.currentCell;
+        if (cell == 0 || c.serviceCell == 0 || (c.serviceCell == cell && c.switchTarget == 0)) return 0.0;
+        if (m_mode == MigrationMode::FLAT) return 0.050;
+        uint64_t bytes = (c.precopyCell == cell && c.precopyDone) ? DeltaBytes() : m_cfg.stateBytes;
+        return TransferTime(bytes);
+    }
+
+    // Dự đoán handover từ xu hướng RSRP: neighbour mạnh nhất đã gần serving và đang tăng
+    void OnMeasurement(const UeState& ue, double servingRsrp, uint16_t neighbourCell, double neighbourRsrp) {
+        if (m_mode != MigrationMode::PROACTIVE) return;
+        UeContainer& c = m_ues[ue.ueId - 1];
+        double margin = neighbourRsrp - servingRsrp;
+        if (neighbourCell != c.trendCell) { c.trendCell = neighbourCell; c.trend = 0.0; }
+        else c.trend = 0.5 * c.trend + 0.5 * (margin - c.lastMargin);
+        c.lastMargin = margin;
+        if (margin > -m_cfg.precopyMarginDb && c.trend > 0.0) StartPrecopy(ue.ueId - 1, neighbourCell);
+    }
+
+    void OnHandoverStart(const UeState& ue, uint16_t targetCell) {
+        if (m_mode == MigrationMode::PROACTIVE) StartPrecopy(ue.ueId - 1, targetCell);
+    }
+
+    // Proactive chuyển hẳn ngay khi handover xong, không đợi task đầu tiên
+    void OnHandoverEnd(const UeState& ue, uint16_t cellId) {
+        if (m_mode != MigrationMode::PROACTIVE) return;
+        m_ues[ue.ueId - 1].trendCell = 0;
+        SwitchTo(ue.ueId - 1, cellId);
+    }
+
+    void Report(std::ostream& os) const {
+        os << "Migration (" << m_cfg.migration << "): full " << m_started[kMigrateFull]
+           << " | pre-copy " << m_started[kMigratePreCopy] << " (wasted " << WastedPrecopies() << ")"
+           << " | delta " << m_started[kMigrateDelta] << " | moved " << MovedMB() << " MB"
+           << " (wasted " << m_wastedBytes / 1e6 << " MB)" << std::endl;
+    }
+    double MovedMB() const { return m_bytesMoved / 1e6; }
+    // Pre-copy bị bỏ vì đoán sai cell, cộng các pre-copy còn treo lúc kết thúc
+    uint32_t WastedPrecopies() const {
+        uint32_t pending = 0;
+        for (const UeContainer& c : m_ues) if (c.precopyCell != 0) pending++;
+        return m_wasted + pending;
+    }
+
+private:
+    struct UeContainer {
+        uint16_t serviceCell = 0;     // UAV đang chạy container
+        uint16_t precopyCell = 0;     // đích của pre-copy hiện tại (0 = không có)
+        uint32_t precopyTransfer = 0;
+        bool precopyDone = false;
+        uint16_t switchTarget = 0;    // đang chuyển hẳn sang cell này (0 = không)
+        uint16_t trendCell = 0;       // neighbour mạnh nhất đang theo dõi
+        double lastMargin = 0.0, trend = 0.0;   // RSRP neighbour - serving (dB) và độ dốc EWMA
+        std::vector<uint32_t> waiting;          // task đã upload xong, chờ container
+    };
+    struct Transfer {
+        uint32_t slot; uint8_t kind; uint16_t from, to; uint64_t bytes; double started;
+        std::vector<uint16_t> path; uint32_t hop;
+        uint64_t sent, received;
+    };
+    struct X2Link {
+        Ipv4Address peer;
+        std::deque<uint32_t> active;   // transfer đang dùng link, gửi xoay vòng từng chunk
+        bool sending = false;
+    };
+    static uint32_t LinkKey(uint16_t from, uint16_t to) { return ((uint32_t)from << 16) | to; }
+
+    uint64_t DeltaBytes() const { return (uint64_t)(m_cfg.stateBytes * m_cfg.dirtyFraction); }
+    double TransferTime(uint64_t bytes) const {
+        uint64_t chunks = (bytes + kMecChunkBytes - 1) / kMecChunkBytes;
+        return (bytes + chunks * kMigrationOverheadBytes) * 8.0 / m_rateBps + m_delay;
+    }
+
+    void StartPrecopy(uint32_t slot, uint16_t cell) {
+        UeContainer& c = m_ues[slot];
+        if (cell == 0 || cell > mecServers.size() || c.serviceCell == 0 || cell == c.serviceCell ||
+            cell == c.precopyCell || c.switchTarget != 0) return;
+        Abandon(c);
+        c.precopyCell = cell;
+        c.precopyDone = false;
+        c.precopyTransfer = StartTransfer(slot, c.serviceCell, cell, m_cfg.stateBytes, kMigratePreCopy);
+    }
+
+    void SwitchTo(uint32_t slot, uint16_t cell) {
+        UeContainer& c = m_ues[slot];
+        if (c.switchTarget != 0 || cell == c.serviceCell) return;   // đang chuyển: xét lại khi xong
+        c.switchTarget = cell;
+        if (c.precopyCell == cell) {
+            // Pre-copy chưa xong thì delta được gửi ngay khi pre-copy tới nơi
+            if (c.precopyDone) StartTransfer(slot, c.serviceCell, cell, DeltaBytes(), kMigrateDelta);
+            return;
+        }
+        Abandon(c);
+        StartTransfer(slot, c.serviceCell, cell, m_cfg.stateBytes, kMigrateFull);
+    }
+
+    // Pre-copy tới cell UE không đến: transfer vẫn chạy hết (không hủy giữa chừng) nên tính lãng phí cả state
+    void Abandon(UeContainer& c) {
+        if (c.precopyCell == 0) return;
+        m_wasted++;
+        m_wastedBytes += m_cfg.stateBytes;
+        c.precopyCell = 0;
+        c.precopyDone = false;
+    }
+
+    // Đường đi ngắn nhất theo số hop trên đồ thị X2 (BFS)
+    std::vector<uint16_t> Path(uint16_t from, uint16_t to) const {
+        std::vector<uint16_t> prev(m_neighbours.size(), 0), path;
+        std::deque<uint16_t> frontier(1, from);
+        prev[from] = from;
+        while (!frontier.empty() && prev[to] == 0) {
+            uint16_t cell = frontier.front(); frontier.pop_front();
+            for (uint16_t n : m_neighbours[cell]) if (prev[n] == 0) { prev[n] = cell; frontier.push_back(n); }
+        }
+        if (prev[to] == 0) return path;
+        for (uint16_t cell = to; cell != from; cell = prev[cell]) path.push_back(cell);
+        path.push_back(from);
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    uint32_t StartTransfer(uint32_t slot, uint16_t from, uint16_t to, uint64_t bytes, uint8_t kind) {
+        uint32_t id = m_transfers.size();
+        m_transfers.push_back({slot, kind, from, to, bytes, Simulator::Now().GetSeconds(), Path(from, to), 0, 0, 0});
+        m_started[kind]++;
+        if (bytes == 0) Simulator::ScheduleNow(&MigrationManager::Complete, this, id);
+        else if (m_transfers[id].path.empty()) {
+            // Không có đường X2 (hoặc radio abstract): coi như một link cùng băng thông nối thẳng hai UAV
+            m_bytesMoved += bytes;
+            Simulator::Schedule(Seconds(TransferTime(bytes)), &MigrationManager::Complete, this, id);
+        }
+        else StartHop(id);
+        return id;
+    }
+
+    void StartHop(uint32_t id) {
+        Transfer& tr = m_transfers[id];
+        tr.sent = tr.received = 0;
+        uint16_t from = tr.path[tr.hop], to = tr.path[tr.hop + 1];
+        X2Link& link = m_links[LinkKey(from, to)];
+        link.active.push_back(id);
+        if (!link.sending) { link.sending = true; SendNext(from, to); }
+    }
+
+    // Một chunk mỗi lần, nhịp = thời gian phát chunk trên link nên hàng đợi device không tràn
+    void SendNext(uint16_t from, uint16_t to) {
+        PROFILE_SCOPE("Migration::SendNext");
+        X2Link& link = m_links[LinkKey(from, to)];
+        if (link.active.empty()) { link.sending = false; return; }
+        uint32_t id = link.active.front();
+        link.active.pop_front();
+        Transfer& tr = m_transfers[id];
+        uint32_t chunk = std::min<uint64_t>(kMecChunkBytes, tr.bytes - tr.sent);
+        MecTaskHeader hdr; hdr.m_taskId = id; hdr.m_messageBytes = tr.bytes;
+        Ptr<Packet> p = Create<Packet>(chunk);
+        p->AddHeader(hdr);
+        m_sockets[from - 1]->SendTo(p, 0, InetSocketAddress(link.peer, kMigrationPort));
+        tr.sent += chunk;
+        if (tr.sent < tr.bytes) link.active.push_back(id);
+        Simulator::Schedule(Seconds((chunk + kMigrationOverheadBytes) * 8.0 / m_rateBps), &MigrationManager::SendNext, this, from, to);
+    }
+
+    // Header giống input/output task MEC, nhưng id là chỉ số transfer
+    void Receive(Ptr<Socket> socket) {
+        PROFILE_SCOPE("Migration::Receive");
+        Address from;
+        while (Ptr<Packet> p = socket->RecvFrom(from)) {
+            MecTaskHeader hdr;
+            p->RemoveHeader(hdr);
+            if (hdr.m_taskId >= m_transfers.size()) continue;
+            Transfer& tr = m_transfers[hdr.m_taskId];
+            tr.received += p->GetSize();
+            if (tr.received < tr.bytes) continue;
+            m_bytesMoved += tr.bytes;
+            if (++tr.hop + 1 < tr.path.size()) StartHop(hdr.m_taskId);
+            else Complete(hdr.m_taskId);
+        }
+    }
+
+    void Complete(uint32_t id) {
+        const Transfer tr = m_transfers[id];
+        double now = Simulator::Now().GetSeconds();
+        migrationFile.Write({now, tr.slot + 1, tr.from, tr.to, tr.kind, tr.bytes, now - tr.started,
+                             (uint8_t)(tr.path.empty() ? 1 : tr.path.size() - 1)});
+        m_transfers[id].path = std::vector<uint16_t>();
+        UeContainer& c = m_ues[tr.slot];
+        if (tr.kind == kMigratePreCopy) {
+            if (c.precopyTransfer != id || c.precopyCell != tr.to) return;   // đã bị bỏ
+            c.precopyDone = true;
+            if (c.switchTarget == tr.to) StartTransfer(tr.slot, c.serviceCell, tr.to, DeltaBytes(), kMigrateDelta);
+            return;
+        }
+        // Full hoặc delta tới nơi: container chạy ở cell mới
+        c.serviceCell = tr.to;
+        c.switchTarget = 0;
+        if (c.precopyCell == tr.to) { c.precopyCell = 0; c.precopyDone = false; }
+        std::vector<uint32_t> waiting;
+        waiting.swap(c.waiting);
+        for (uint32_t taskId : waiting) RequestService(taskId);
+    }
+
+    MigrationMode m_mode = MigrationMode::REACTIVE;
+    MecConfig m_cfg;
+    double m_rateBps = 1e9, m_delay = 0.0;
+    std::vector<UeContainer> m_ues;           // index = slot
+    std::vector<Transfer> m_transfers;        // index = transfer id
+    std::vector<Ptr<Socket>> m_sockets;       // index = cellId - 1
+    std::map<uint32_t, X2Link> m_links;       // (from << 16 | to)
+    std::vector<std::vector<uint16_t>> m_neighbours;   // index = cellId
+    uint32_t m_started[3] = {0, 0, 0};
+    uint32_t m_wasted = 0;
+    uint64_t m_bytesMoved = 0, m_wastedBytes = 0;
+};
+
+MigrationManager migration;
+
+void RequestMecService(uint32_t taskId) { migration.RequestService(taskId); }
+double EstimateMigrationDelay(const UeState& ue) { return migration.EstimateDelay(ue); }
+
+// ==================== RADIO RATE TABLE ====================
+// Bảng SINR (dB) -> throughput downlink của một UE (Mb/s), nội suy tuyến tính giữa các mốc.
+// File "SinrDb,ThroughputMbps[,Samples]" được tạo bằng --radioTableOut từ một run LTE đầy đủ:
+// mỗi mẫu throughput 100 ms ghép với SINR báo cáo gần nhất của UE, gom theo bin 1 dB.
+const uint32_t kDlPacketBytes = 1472;   // gói downlink của mỗi UE (TrafficSource trên remoteHost)
+const double kDlIntervalMs = 4.0;
+const double kDlOfferedMbps = kDlPacketBytes * 8.0 / 1e3 / kDlIntervalMs;
+
+class RateTable {
+public:
+    bool Empty() const { return m_sinrDb.empty(); }
+    void Add(double sinrDb, double mbps) { m_sinrDb.push_back(sinrDb); m_mbps.push_back(mbps); }   // SINR tăng dần
+
+    double Lookup(double sinrDb) const {
+        if (m_sinrDb.empty()) return 0.0;
+        if (sinrDb <= m_sinrDb.front()) return m_mbps.front();
+        if (sinrDb >= m_sinrDb.back()) return m_mbps.back();
+        size_t i = std::upper_bound(m_sinrDb.begin(), m_sinrDb.end(), sinrDb) - m_sinrDb.begin();
+        double f = (sinrDb - m_sinrDb[i - 1]) / (m_sinrDb[i] - m_sinrDb[i - 1]);
+        return m_mbps[i - 1] + f * (m_mbps[i] - m_mbps[i - 1]);
+    }
+
+    // Throughput nhỏ nhất còn > 0 (mép vùng phủ), 0 nếu bảng toàn 0
+    double MinPositive() const {
+        double best = 0.0;
+        for (double mbps : m_mbps) if (mbps > 0.0 && (best == 0.0 || mbps < best)) best = mbps;
+        return best;
+    }
+
+    void Load(const std::string& path) {
+        std::ifstream in(path);
+        NS_ABORT_MSG_IF(!in.is_open(), "Cannot open radio table " << path);
+        std::string line;
+        std::getline(in, line);   // header
+        while (std::getline(in, line)) {
+            std::vector<double> v = ParseCsvNumbers(line);
+            if (v.size() < 2) continue;
+            NS_ABORT_MSG_IF(!m_sinrDb.empty() && v[0] <= m_sinrDb.back(), "Radio table " << path << " must be sorted by SINR");
+            Add(v[0], v[1]);
+        }
+        NS_ABORT_MSG_IF(m_sinrDb.empty(), "Radio table " << path << " is empty");
+    }
+
+private:
+    static std::vector<double> ParseCsvNumbers(const std::string& line) {
+        std::vector<double> v;
+        std::stringstream ss(line);
+        std::string item;
+        while (std::getline(ss, item, ',')) v.push_back(std::stod(item));
+        return v;
+    }
+    std::vector<double> m_sinrDb, m_mbps;
+};
+
+// Gom mẫu (SINR, throughput) của run LTE thành bảng cho radio abstract
+class RateCalibration {
+public:
+    void Open(const std::string& path) { m_path = path; m_bins.clear(); }
+    bool Enabled() const { return !m_path.empty(); }
+    void Add(double sinrDb, double mbps) {
+        Bin& b = m_bins[(int)std::lround(sinrDb)];
+        b.sum += mbps; b.count++;
+    }
+    void Close() {
+        if (m_path.empty()) return;
+        std::ofstream out(m_path);
+        out << "SinrDb,ThroughputMbps,Samples\n";
+        for (const auto& b : m_bins) out << b.first << "," << b.second.sum / b.second.count << "," << b.second.count << "\n";
+        std::cout << "Radio table (" << m_bins.size() << " SINR bins) written to " << m_path << std::endl;
+        m_path.clear();
+    }
+
+private:
+    struct Bin { double sum = 0.0; uint64_t count = 0; };
+    std::string m_path;
+    std::map<int, Bin> m_bins;   // SINR làm tròn 1 dB
+};
+
+RateCalibration rateCalibration;
+
+// ==================== TRAFFIC PROFILES ====================
+// Downlink của mỗi UE do một TrafficSource trên remoteHost phát; profile chọn theo lớp UE:
+//  - cbr: gói 1472 B đều đặn ở trafficRate (mặc định 4 ms/gói)
+//  - fullbuffer: phát kFullBufferMbps, luôn vượt dung lượng cell -> cell bão hoà
+//  - onoff: cbr trong các khoảng on / off có độ dài phân bố mũ (onTime / offTime)
+//  - poisson: burst burstBytes đến theo Poisson (trung bình burstInterval), phát dồn một lần
+//  - adaptive: bắt đầu ở rampStep, mỗi rampInterval tăng rampStep nếu loss <= lossThreshold, vượt thì giảm nửa
+// Gói mang SeqTsHeader nên PacketStats (loss, reorder, gián đoạn HO) không đổi.
+// ulRate > 0 thêm một luồng cbr uplink UE -> remoteHost, chạy cùng upload task MEC.
+enum class TrafficKind { CBR, FULL_BUFFER, ON_OFF, POISSON, ADAPTIVE };
+enum class UeClass { STATIC, VEHICULAR, PEDESTRIAN };
+const double kFullBufferMbps = 100.0;   // > dung lượng 5 MHz ở CQI cao nhất
+
+struct TrafficConfig {
+    std::string profile = "cbr";     // mọi UE, trừ khi lớp của UE có profile riêng
+    std::string staticProfile, vehicularProfile, pedestrianProfile;   // trống = profile
+    double rateMbps = kDlOfferedMbps;// cbr / onoff
+    double onTime = 1.0;             // s, trung bình khoảng on
+    double offTime = 1.0;            // s, trung bình khoảng off
+    uint32_t burstBytes = 500000;    // poisson
+    double burstInterval = 1.0;      // s, trung bình giữa 2 burst
+    double rampStepMbps = 0.5;       // adaptive
+    double rampInterval = 1.0;       // s
+    double lossThreshold = 0.01;     // adaptive và tiêu chí "chịu được" của đường cong dung lượng
+    double ulRateMbps = 0.0;         // cbr uplink mỗi UE (0 = tắt)
+    double capacityInterval = 1.0;   // s giữa 2 mẫu dung lượng cell
+};
+
+TrafficConfig trafficCfg;
+std::vector<UeClass> ueClasses;      // index = slot; trống (kịch bản gốc, trace) = pedestrian
+
+TrafficKind ParseTrafficKind(const std::string& name) {
+    if (name == "cbr") return TrafficKind::CBR;
+    if (name == "fullbuffer") return TrafficKind::FULL_BUFFER;
+    if (name == "onoff") return TrafficKind::ON_OFF;
+    if (name == "poisson") return TrafficKind::POISSON;
+    NS_ABORT_MSG_IF(name != "adaptive", "Unknown traffic profile " << name);
+    return TrafficKind::ADAPTIVE;
+}
+
+TrafficKind TrafficKindOf(uint32_t slot) {
+    UeClass c = slot < ueClasses.size() ? ueClasses[slot] : UeClass::PEDESTRIAN;
+    const std::string& name = c == UeClass::STATIC ? trafficCfg.staticProfile
+                            : c == UeClass::VEHICULAR ? trafficCfg.vehicularProfile : trafficCfg.pedestrianProfile;
+    return ParseTrafficKind(name.empty() ? trafficCfg.profile : name);
+}
+
+class TrafficSource : public Application {
+public:
+    static TypeId GetTypeId() {
+        static TypeId tid = TypeId("TrafficSource").SetParent<Application>().AddConstructor<TrafficSource>();
+        return tid;
+    }
+
+    // ue: UE nhận (đếm byte phát, phản hồi loss cho adaptive); nullptr với luồng uplink
+    void Setup(TrafficKind kind, double rateMbps, const Address& dest, UeState* ue) {
+        m_kind = kind; m_rate = rateMbps; m_dest = dest; m_ue = ue;
+        if (kind == TrafficKind::FULL_BUFFER) m_rate = kFullBufferMbps;
+        if (kind == TrafficKind::ADAPTIVE) m_rate = trafficCfg.rampStepMbps;
+        // Chỉ onoff / poisson cần RNG: cbr, fullbuffer, adaptive không lấy stream nào
+        if (kind == TrafficKind::POISSON || kind == TrafficKind::ON_OFF) {
+            m_onGap = CreateObject<ExponentialRandomVariable>();
+            m_onGap->SetAttribute("Mean", DoubleValue(kind == TrafficKind::POISSON ? trafficCfg.burstInterval : trafficCfg.onTime));
+        }
+        if (kind == TrafficKind::ON_OFF) {
+            m_offGap = CreateObject<ExponentialRandomVariable>();
+            m_offGap->SetAttribute("Mean", DoubleValue(trafficCfg.offTime));
+        }
+    }
+
+    TrafficKind Kind() const { return m_kind; }
+    double SustainedMbps() const { return m_sustained; }   // adaptive: tốc độ cao nhất còn loss <= ngưỡng
+
+private:
+    void StartApplication() override {
+        m_socket = Socket::CreateSocket(GetNode(), UdpSocketFactory::GetTypeId());
+        m_socket->Bind();
+        m_socket->Connect(m_dest);
+        if (m_kind == TrafficKind::POISSON) {
+            m_sendEvent = Simulator::Schedule(Seconds(m_onGap->GetValue()), &TrafficSource::Burst, this);
+            return;
+        }
+        if (m_kind == TrafficKind::ON_OFF) m_toggleEvent = Simulator::Schedule(Seconds(m_onGap->GetValue()), &TrafficSource::Toggle, this);
+        if (m_kind == TrafficKind::ADAPTIVE && m_ue) {
+            m_lastLost = m_ue->packets.lost; m_lastReceived = m_ue->packets.received;
+            m_toggleEvent = Simulator::Schedule(Seconds(trafficCfg.rampInterval), &TrafficSource::Ramp, this);
+        }
+        Send();
+    }
+
+    void StopApplication() override {
+        Simulator::Cancel(m_sendEvent);
+        Simulator::Cancel(m_toggleEvent);
+        if (m_socket) m_socket->Close();
+    }
+
+    void SendPacket() {
+        SeqTsHeader hdr;
+        hdr.SetSeq(m_seq++);
+        Ptr<Packet> p = Create<Packet>(kDlPacketBytes - hdr.GetSerializedSize());
+        p->AddHeader(hdr);
+        if (m_socket->Send(p) >= 0 && m_ue) m_ue->offeredBytes += kDlPacketBytes;
+    }
+
+    void Send() {
+        SendPacket();
+        m_sendEvent = Simulator::Schedule(Seconds(kDlPacketBytes * 8.0 / (m_rate * 1e6)), &TrafficSource::Send, this);
+    }
+
+    void Toggle() {
+        m_on = !m_on;
+        if (m_on) Send();
+        else Simulator::Cancel(m_sendEvent);
+        m_toggleEvent = Simulator::Schedule(Seconds(m_on ? m_onGap->GetValue() : m_offGap->GetValue()), &TrafficSource::Toggle, this);
+    }
+
+    void Burst() {
+        for (uint32_t sent = 0; sent < trafficCfg.burstBytes; sent += kDlPacketBytes) SendPacket();
+        m_sendEvent = Simulator::Schedule(Seconds(m_onGap->GetValue()), &TrafficSource::Burst, this);
+    }
+
+    void Ramp() {
+        const PacketStats& ps = m_ue->packets;
+        uint64_t lost = ps.lost - m_lastLost, received = ps.received - m_lastReceived;
+        m_lastLost = ps.lost; m_lastReceived = ps.received;
+        double loss = lost + received ? (double)lost / (lost + received) : 0.0;
+        if (loss > trafficCfg.lossThreshold) {
+            m_rate = std::max(trafficCfg.rampStepMbps, m_rate / 2);
+        } else {
+            m_sustained = std::max(m_sustained, m_rate);
+            m_rate += trafficCfg.rampStepMbps;
+        }
+        m_toggleEvent = Simulator::Schedule(Seconds(trafficCfg.rampInterval), &TrafficSource::Ramp, this);
+    }
+
+    TrafficKind m_kind = TrafficKind::CBR;
+    double m_rate = kDlOfferedMbps, m_sustained = 0.0;
+    Address m_dest;
+    UeState* m_ue = nullptr;
+    Ptr<Socket> m_socket;
+    Ptr<ExponentialRandomVariable> m_onGap, m_offGap;
+    EventId m_sendEvent, m_toggleEvent;
+    uint32_t m_seq = 0;
+    bool m_on = true;
+    uint64_t m_lastLost = 0, m_lastReceived = 0;
+};
+NS_OBJECT_ENSURE_REGISTERED(TrafficSource);
+
+std::vector<Ptr<TrafficSource>> dlSources;   // index = slot
+const uint16_t kDlPort = 1234;
+const uint16_t kUlPort = 1235;
+Ipv4Address remoteHostAddr;
+Ptr<PacketSink> ulSinkApp;                   // sink uplink trên remoteHost (ulRate > 0)
+
+// Dung lượng từng cell theo thời gian: mỗi capacityInterval cộng offered / delivered / loss của các UE
+// đang gắn vào cell. Đường cong gom theo số UE trong cell (chỉ các khoảng không có UE đang handover);
+// "chịu được" = loss <= lossThreshold và delivered >= 95% offered.
+class CellCapacityMonitor {
+public:
+    void Install(uint32_t numUes, uint32_t numCells, double stopTime) {
+        m_last.assign(numUes, Counters());
+        m_curve.assign(numCells, std::map<uint32_t, Bin>());
+        m_installed = true;
+        double interval = trafficCfg.capacityInterval;
+        PeriodicSampler::Get().Register(Seconds(interval), Seconds(1.0 + interval), Seconds(stopTime), [this, interval] { Sample(interval); });
+    }
+
+    void Close(std::ostream& os) {
+        if (!m_installed) return;
+        m_installed = false;
+        std::ofstream curve("scenario1_final_capacity_curve.csv");
+        curve << "CellId,Ues,Intervals,OfferedMbps,DeliveredMbps,PerUeMbps,LossRate(%),Sustainable\n";
+        std::vector<uint32_t> maxUes;
+        double peak = 0.0, hoPerUe = m_hoUeIntervals ? m_hoDelivered / m_hoUeIntervals : 0.0;
+        for (uint32_t c = 0; c < m_curve.size(); ++c) {
+            uint32_t best = 0;
+            for (const auto& entry : m_curve[c]) {
+                const Bin& b = entry.second;
+                double offered = b.offered / b.intervals, delivered = b.delivered / b.intervals;
+                double loss = b.lost + b.received ? 100.0 * b.lost / (b.lost + b.received) : 0.0;
+                bool ok = loss <= trafficCfg.lossThreshold * 100.0 && delivered >= 0.95 * offered;
+                if (ok) best = std::max(best, entry.first);
+                peak = std::max(peak, delivered);
+                curve << c + 1 << "," << entry.first << "," << b.intervals << "," << offered << "," << delivered << ","
+                      << delivered / entry.first << "," << loss << "," << ok << "\n";
+            }
+            if (!m_curve[c].empty()) maxUes.push_back(best);
+        }
+        std::sort(maxUes.begin(), maxUes.end());
+        os << "Cell capacity: peak " << peak << " Mb/s per cell | max sustainable UEs per UAV min/median/max "
+           << (maxUes.empty() ? 0 : maxUes.front()) << " / " << (maxUes.empty() ? 0 : maxUes[maxUes.size() / 2]) << " / "
+           << (maxUes.empty() ? 0 : maxUes.back()) << " | per-UE delivered " << (m_ueIntervals ? m_delivered / m_ueIntervals : 0.0)
+           << " Mb/s, " << hoPerUe << " Mb/s while handing over" << std::endl;
+    }
+
+private:
+    struct Counters { uint64_t offered = 0, delivered = 0, lost = 0, received = 0; };
+    struct Cell { uint32_t ues = 0, hoUes = 0; double offered = 0.0, delivered = 0.0; uint64_t lost = 0, received = 0; };
+    struct Bin { uint32_t intervals = 0; double offered = 0.0, delivered = 0.0; uint64_t lost = 0, received = 0; };
+
+    void Sample(double window) {
+        PROFILE_SCOPE("CellCapacityMonitor::Sample");
+        std::vector<Cell> cells(m_curve.size());
+        for (uint32_t i = 0; i < m_last.size() && i < ueSinks.size(); ++i) {
+            const UeState& ue = ueState[i];
+            Counters now{ue.offeredBytes, ueSinks[i]->GetTotalRx(), ue.packets.lost, ue.packets.received};
+            Counters& last = m_last[i];
+            double offered = (now.offered - last.offered) * 8.0 / 1e6 / window;
+            double delivered = (now.delivered - last.delivered) * 8.0 / 1e6 / window;
+            uint64_t lost = now.lost - last.lost, received = now.received - last.received;
+            last = now;
+            if (ue.currentCell == 0 || ue.currentCell > cells.size()) continue;
+            Cell& c = cells[ue.currentCell - 1];
+            c.ues++; c.offered += offered; c.delivered += delivered; c.lost += lost; c.received += received;
+            if (ue.packets.hoOpen) { c.hoUes++; m_hoDelivered += delivered; m_hoUeIntervals++; }
+            else { m_delivered += delivered; m_ueIntervals++; }
+        }
+        double time = Simulator::Now().GetSeconds();
+        for (uint32_t c = 0; c < cells.size(); ++c) {
+            const Cell& cell = cells[c];
+            if (cell.ues == 0) continue;
+            double loss = cell.lost + cell.received ? 100.0 * cell.lost / (cell.lost + cell.received) : 0.0;
+            cellCapacityFile.Write({time, (uint16_t)(c + 1), cell.ues, cell.hoUes, cell.offered, cell.delivered, loss});
+            if (cell.hoUes > 0) continue;
+            Bin& b = m_curve[c][cell.ues];
+            b.intervals++; b.offered += cell.offered; b.delivered += cell.delivered; b.lost += cell.lost; b.received += cell.received;
+        }
+    }
+
+    std::vector<Counters> m_last;                  // index = slot
+    std::vector<std::map<uint32_t, Bin>> m_curve;  // index = cellId - 1, key = số UE
+    bool m_installed = false;
+    double m_delivered = 0.0, m_hoDelivered = 0.0;
+    uint64_t m_ueIntervals = 0, m_hoUeIntervals = 0;
+};
+
+CellCapacityMonitor cellCapacity;
+
+void ReportTraffic(std::ostream& os, double simTime) {
+    if (dlSources.empty()) return;
+    uint32_t count[5] = {0, 0, 0, 0, 0};
+    std::vector<double> sustained;
+    for (const Ptr<TrafficSource>& src : dlSources) {
+        count[(int)src->Kind()]++;
+        if (src->Kind() == TrafficKind::ADAPTIVE) sustained.push_back(src->SustainedMbps());
+    }
+    os << "Traffic: cbr " << count[0] << " | fullbuffer " << count[1] << " | onoff " << count[2]
+       << " | poisson " << count[3] << " | adaptive " << count[4] << " UEs";
+    std::sort(sustained.begin(), sustained.end());
+    if (!sustained.empty())
+        os << " | adaptive sustained min/median " << sustained.front() << " / " << sustained[sustained.size() / 2] << " Mb/s";
+    if (ulSinkApp) os << " | uplink delivered " << ulSinkApp->GetTotalRx() * 8.0 / 1e6 / std::max(1.0, simTime - 1.0) << " Mb/s";
+    os << std::endl;
+}
+
+// ==================== HANDOVER CALLBACKS ====================
+// ---------- User-plane quanh handover ----------
+const double kHoWindow = 1.0;   // s sau gói đầu tiên ở cell mới vẫn tính loss/reorder cho handover
+
+void CloseHoWindow(UeState& ue) {
+    PacketStats& s = ue.packets;
+    s.hoOpen = false;
+    if (s.hoWaitingFirst) return;   // chưa nhận lại gói nào: không đo được gián đoạn
+    double ms = s.hoInterruption * 1000.0;
+    s.handovers++;
+    s.interruptionSum += ms;
+    s.interruptionMax = std::max(s.interruptionMax, ms);
+    kpiStats.Record(KPI_HO_INTERRUPTION, ue.ueId - 1, s.hoTarget, ms);
+    hoInterruptionFile.Write({s.hoStart, ue.ueId, s.hoSource, s.hoTarget, ms, s.hoLost, s.hoReordered, s.hoMaxBurst, s.hoMaxDelay * 1000.0});
+}
+
+void OpenHoWindow(UeState& ue, uint16_t source, uint16_t target) {
+    PacketStats& s = ue.packets;
+    if (s.hoOpen) CloseHoWindow(ue);
+    s.hoOpen = true; s.hoWaitingFirst = true;
+    s.hoSource = source; s.hoTarget = target;
+    s.hoStart = Simulator::Now().GetSeconds();
+    s.hoLastSourceRx = s.lastRx;
+    s.hoLost = s.hoReordered = s.hoMaxBurst = 0;
+    s.hoMaxDelay = 0.0;
+}
+
+// Rx trace của PacketSink: delay một chiều, mất gói theo khoảng trống seq, gói đến trễ
+void UePacketRx(UeState* ue, Ptr<const Packet> packet, const Address& from) {
+    PROFILE_SCOPE("UePacketRx");
+    SeqTsHeader hdr;
+    if (packet->GetSize() < hdr.GetSerializedSize()) return;
+    packet->PeekHeader(hdr);
+    double now = Simulator::Now().GetSeconds();
+    double delay = now - hdr.GetTs().GetSeconds();
+    uint32_t seq = hdr.GetSeq();
+    PacketStats& s = ue->packets;
+    // Bản lặp của gói mới nhất (seq == highestSeq): không phải gói đến trễ, bỏ qua hoàn toàn
+    if (s.any && seq == s.highestSeq) return;
+    s.received++;
+    kpiStats.Record(KPI_PACKET_DELAY, ue->ueId - 1, ue->currentCell, delay * 1000.0);
+
+    if (s.hoOpen && !s.hoWaitingFirst && now > s.hoWindowEnd) CloseHoWindow(*ue);
+    if (s.hoOpen && s.hoWaitingFirst) {
+        s.hoInterruption = now - (s.hoLastSourceRx >= 0 ? s.hoLastSourceRx : s.hoStart);
+        s.hoWaitingFirst = false;
+        s.hoWindowEnd = now + kHoWindow;
+    }
+
+    if (!s.any) {
+        s.any = true;
+        s.highestSeq = seq;
+    } else if (seq > s.highestSeq) {
+        uint32_t gap = seq - s.highestSeq - 1;
+        if (gap > 0) {
+            s.lost += gap; s.lossBursts++;
+            s.maxLossBurst = std::max(s.maxLossBurst, gap);
+            if (s.hoOpen) { s.hoLost += gap; s.hoMaxBurst = std::max(s.hoMaxBurst, gap); }
+        }
+        s.highestSeq = seq;
+    } else {
+        // seq < highestSeq: gói đến sau gói có seq lớn hơn, trước đó đã bị tính là mất
+        s.reordered++;
+        if (s.lost > 0) s.lost--;
+        if (s.hoOpen) { s.hoReordered++; if (s.hoLost > 0) s.hoLost--; }
+    }
+    if (s.hoOpen) s.hoMaxDelay = std::max(s.hoMaxDelay, delay);
+    s.lastRx = now;
+}
+
+// HO thứ hai quay về đúng cell vừa rời, sau thời gian ở lại (từ lúc HO trước xong) <= window
+bool IsPingPongHandover(const HandoverTracker& t, uint16_t source, uint16_t target, double start, double window) {
+    return t.lastTarget == source && t.lastSource == target && start - t.lastEnd <= window;
+}
+
+// Phân loại handover theo MRO (3GPP TS 36.300 22.4.2), chỉ dùng HandoverTracker của UE:
+//  - ping-pong: A -> B rồi B -> A trong pingPongWindow
+//  - too-late: RLF khi đã ở cell lâu (không có HO nào trong hoFailureWindow), kết nối lại ở cell khác;
+//    HO lỗi mà UE kết nối lại ngay ở target cũng tính too-late (kích hoạt khi link đã quá yếu)
+//  - too-early: HO lỗi, hoặc RLF trong hoFailureWindow sau HO, rồi kết nối lại ở source
+//  - wrong-cell: như too-early nhưng kết nối lại ở cell thứ ba
+// Thống kê gom theo cặp (source, target) và theo lớp UE; bộ nhớ mỗi UE là O(1).
+enum HoIssue { HO_PINGPONG, HO_TOO_EARLY, HO_TOO_LATE, HO_WRONG_CELL, HO_ISSUE_COUNT };
+
+class HandoverAnalytics {
+public:
+    void Configure(uint32_t cells) {
+        m_cells = cells;
+        m_pairs.assign(cells * cells, PairStats());
+    }
+    void SetWindows(double pingPongWindow, double failureWindow) { m_window = pingPongWindow; m_failureWindow = failureWindow; }
+
+    void OnStart(UeState& ue, uint16_t source, uint16_t target, double now) {
+        HandoverTracker& t = ue.hoTracker;
+        t.phase = HoPhase::HANDOVER; t.source = source; t.target = target; t.start = now;
+        Pair(source, target).attempts++;
+    }
+
+    // Trả về true nếu là ping-pong
+    bool OnEndOk(UeState& ue, uint16_t cellId, double now) {
+        HandoverTracker& t = ue.hoTracker;
+        if (t.phase != HoPhase::HANDOVER) { t.source = ue.currentCell; t.start = now; }
+        t.phase = HoPhase::CONNECTED; t.target = cellId;
+        PairStats& pair = Pair(t.source, cellId);
+        pair.success++;
+        pair.durationSum += now - t.start;
+        ClassStats& cls = Class(ue);
+        cls.handovers++;
+        bool pingPong = IsPingPongHandover(t, t.source, cellId, t.start, m_window);
+        if (pingPong) Issue(HO_PINGPONG, ue, t.source, cellId, cellId, now);
+        t.lastSource = t.source; t.lastTarget = cellId; t.lastEnd = now;
+        return pingPong;
+    }
+
+    // HandoverEndError (handover = true) hoặc RLF; UE rời cell cho tới khi kết nối lại
+    void OnFailure(UeState& ue, uint16_t cellId, double now, bool handover) {
+        HandoverTracker& t = ue.hoTracker;
+        if (t.phase == HoPhase::DETACHED) return;
+        bool inHandover = handover || t.phase == HoPhase::HANDOVER;
+        if (inHandover) Pair(t.source, t.target).failures++;
+        if (!handover) { m_rlfs++; Class(ue).rlfs++; }
+        else m_hoFailures++;
+        t.phase = HoPhase::DETACHED;
+        t.lostInHandover = inHandover;
+        t.lostCell = inHandover ? t.source : cellId;
+        t.lostAt = now;
+    }
+
+    // ConnectionEstablished: lần đầu thì bỏ qua, sau RLF / HO lỗi thì phân loại theo cell kết nối lại
+    void OnConnected(UeState& ue, uint16_t cellId, double now) {
+        HandoverTracker& t = ue.hoTracker;
+        if (t.phase != HoPhase::DETACHED) { t.phase = HoPhase::CONNECTED; return; }
+        t.phase = HoPhase::CONNECTED;
+        if (t.lostInHandover) {
+            HoIssue type = cellId == t.source ? HO_TOO_EARLY : cellId == t.target ? HO_TOO_LATE : HO_WRONG_CELL;
+            Issue(type, ue, t.source, t.target, cellId, now);
+        } else if (t.lastTarget == t.lostCell && t.lostAt - t.lastEnd <= m_failureWindow) {
+            // RLF ngay sau một HO thành công
+            if (cellId == t.lastSource) Issue(HO_TOO_EARLY, ue, t.lastSource, t.lastTarget, cellId, now);
+            else if (cellId != t.lostCell) Issue(HO_WRONG_CELL, ue, t.lastSource, t.lastTarget, cellId, now);
+        } else if (cellId != t.lostCell) {
+            Issue(HO_TOO_LATE, ue, t.lostCell, cellId, cellId, now);
+        }
+    }
+
+    uint32_t Count(HoIssue type) const { return m_issues[type]; }
+    uint32_t Rlfs() const { return m_rlfs; }
+    uint32_t Failures() const { return m_hoFailures; }
+
+    void Report(const std::string& fileName, std::ostream& os) const {
+        std::ofstream out(fileName);
+        out << "Source,Target,Attempts,Success,Failures,PingPong,TooEarly,TooLate,WrongCell,MeanDuration(ms),PingPongRate(%)\n";
+        for (uint32_t i = 0; i < m_pairs.size(); ++i) {
+            const PairStats& p = m_pairs[i];
+            if (p.attempts == 0 && p.success == 0 && p.issues[HO_TOO_LATE] == 0) continue;
+            out << i / m_cells + 1 << "," << i % m_cells + 1 << "," << p.attempts << "," << p.success << "," << p.failures;
+            for (uint32_t k = 0; k < HO_ISSUE_COUNT; ++k) out << "," << p.issues[k];
+            out << "," << (p.success ? p.durationSum / p.success * 1000.0 : 0.0) << ","
+                << (p.success ? 100.0 * p.issues[HO_PINGPONG] / p.success : 0.0) << "\n";
+        }
+        os << "Handover analytics (ping-pong window " << m_window << " s, failure window " << m_failureWindow
+           << " s): ping-pong " << m_issues[HO_PINGPONG] << " | too-early " << m_issues[HO_TOO_EARLY]
+           << " | too-late " << m_issues[HO_TOO_LATE] << " | wrong-cell " << m_issues[HO_WRONG_CELL]
+           << " | HO failures " << m_hoFailures << " | RLF " << m_rlfs << std::endl;
+        static const char* kClassNames[] = {"static", "vehicular", "pedestrian"};
+        for (uint32_t c = 0; !ueClasses.empty() && c < 3; ++c) {
+            const ClassStats& cls = m_classes[c];
+            os << "  " << kClassNames[c] << ": HO " << cls.handovers << " | ping-pong " << cls.issues[HO_PINGPONG]
+               << " | too-early " << cls.issues[HO_TOO_EARLY] << " | too-late " << cls.issues[HO_TOO_LATE]
+               << " | wrong-cell " << cls.issues[HO_WRONG_CELL] << " | RLF " << cls.rlfs << std::endl;
+        }
+    }
+
+private:
+    struct PairStats {
+        uint32_t attempts = 0, success = 0, failures = 0;
+        uint32_t issues[HO_ISSUE_COUNT] = {0, 0, 0, 0};
+        double durationSum = 0.0;
+    };
+    struct ClassStats { uint32_t handovers = 0, rlfs = 0; uint32_t issues[HO_ISSUE_COUNT] = {0, 0, 0, 0}; };
+
+    PairStats& Pair(uint16_t source, uint16_t target) {
+        if (source == 0 || target == 0 || source > m_cells || target > m_cells) return m_unknown;
+        return m_pairs[(source - 1) * m_cells + target - 1];
+    }
+    ClassStats& Class(const UeState& ue) {
+        uint32_t slot = ue.ueId - 1;
+        return m_classes[(int)(slot < ueClasses.size() ? ueClasses[slot] : UeClass::PEDESTRIAN)];
+    }
+    void Issue(HoIssue type, UeState& ue, uint16_t source, uint16_t target, uint16_t reconnect, double now) {
+        m_issues[type]++;
+        Pair(source, target).issues[type]++;
+        Class(ue).issues[type]++;
+        handoverIssueFile.Write({now, ue.imsi, (uint8_t)type, source, target, reconnect});
+    }
+
+    uint32_t m_cells = 0;
+    double m_window = 1.0, m_failureWindow = 1.0;
+    std::vector<PairStats> m_pairs;     // [(source - 1) * cells + target - 1]
+    PairStats m_unknown;                // cell ngoài bảng (chưa Configure)
+    ClassStats m_classes[3];            // index = UeClass
+    uint32_t m_issues[HO_ISSUE_COUNT] = {0, 0, 0, 0};
+    uint32_t m_rlfs = 0, m_hoFailures = 0;
+};
+
+HandoverAnalytics hoAnalytics;
+
+void NotifyHandoverStartUe(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId) {   
+    PROFILE_SCOPE("HandoverStart");
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (!ue) return;
+    handoverStartCount++;
+    HandoverEvent& event = ue->lastHandover; event.time = Simulator::Now().GetSeconds();
+    event.imsi = imsi; event.sourceCellId = cellId; event.targetCellId = targetCellId;
+    event.throughputBefore = ue->lastThroughput;
+    ue->hasHandoverEvent = true;
+    hoAnalytics.OnStart(*ue, cellId, targetCellId, event.time);
+    migration.OnHandoverStart(*ue, targetCellId);
+    OpenHoWindow(*ue, cellId, targetCellId);
+}
+
+void NotifyHandoverEndOkUe(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
+    PROFILE_SCOPE("HandoverEndOk");
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (!ue) return;
+    handoverCount++;
+    double time = Simulator::Now().GetSeconds();
+    
+    bool pingPong = hoAnalytics.OnEndOk(*ue, cellId, time);
+    if (pingPong) pingPongHandoverCount++;
+
+    // Cập nhật bản đồ vị trí ngay lập tức để MEC biết
+    ue->currentCell = cellId; 
+    migration.OnHandoverEnd(*ue, cellId);
+    
+    if (ue->hasHandoverEvent) {
+        const HandoverEvent& ev = ue->lastHandover;
+        double duration = time - ev.time;
+        double degradation = 0.0;
+        if (ev.throughputBefore > 0) degradation = (ev.throughputBefore - ue->lastThroughput)/ev.throughputBefore*100.0;
+        
+        handoverQualityFile.Write({time, imsi, ev.sourceCellId, ev.targetCellId, pingPong,
+                                   duration, ev.throughputBefore, ue->lastThroughput, degradation});
+        
+        hoTraceFile.Write({time, imsi, ev.sourceCellId, ev.targetCellId});
+        
+        std::cout << "   [HO SUCCESS] Time: " << std::fixed << std::setprecision(2) << time 
+                  << "s | UE" << imsi << " switched: Cell " << ev.sourceCellId 
+                  << " --> Cell " << ev.targetCellId << std::endl;
+    }
+    handoverFile.Write({time, imsi, cellId, handoverCount, pingPong});
+    
+    UpdateUeColor(ue->ueId - 1, cellId);
+}
+
+// HO lỗi (T304 hết hạn) hoặc RLF: UE rời cell, chờ ConnectionEstablished ở cell mới để phân loại
+void NotifyLinkLoss(uint64_t imsi, uint16_t cellId, bool handover) {
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (!ue) return;
+    double time = Simulator::Now().GetSeconds();
+    hoAnalytics.OnFailure(*ue, cellId, time, handover);
+    ue->hasHandoverEvent = false;
+    ue->currentCell = 0;
+    std::cout << "   [" << (handover ? "HO FAILURE" : "RLF") << "] Time: " << std::fixed << std::setprecision(2) << time
+              << "s | UE" << imsi << " lost Cell " << cellId << std::endl;
+}
+
+void NotifyHandoverEndErrorUe(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
+    PROFILE_SCOPE("HandoverEndError");
+    NotifyLinkLoss(imsi, cellId, true);
+}
+
+void NotifyRadioLinkFailure(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
+    PROFILE_SCOPE("RadioLinkFailure");
+    NotifyLinkLoss(imsi, cellId, false);
+}
+
+// RSRP (dBm) của serving và các neighbour trong một báo cáo đo; dùng chung cho LTE và radio abstract
+void ProcessMeasurementReport(uint64_t imsi, double servingRsrp, const std::vector<std::pair<uint16_t, double>>& neighbours) {
+    double time = Simulator::Now().GetSeconds();
+    uint16_t bestCell = 0;
+    double bestRsrp = -1e9;
+    for (const std::pair<uint16_t, double>& n : neighbours) {
+        rsrpFile.Write({time, imsi, n.first, n.second});
+        if (n.second > bestRsrp) { bestRsrp = n.second; bestCell = n.first; }
+    }
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (ue && bestCell != 0) migration.OnMeasurement(*ue, servingRsrp, bestCell, bestRsrp);
+}
+
+void RecvMeasurementReportCallback(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti, LteRrcSap::MeasurementReport report) {
+    PROFILE_SCOPE("RecvMeasurementReport");
+    std::vector<std::pair<uint16_t, double>> neighbours;
+    if (report.measResults.haveMeasResultNeighCells) {
+        for (auto it = report.measResults.measResultListEutra.begin(); it != report.measResults.measResultListEutra.end(); ++it) {
+            if (it->haveRsrpResult) neighbours.push_back({it->physCellId, -140.0 + (double)it->rsrpResult});
+        }
+    }
+    ProcessMeasurementReport(imsi, -140.0 + (double)report.measResults.measResultPCell.rsrpResult, neighbours);
+}
+
+void ReportRsrp(uint64_t imsi, uint16_t cellId, uint16_t rnti, double rsrp, double sinr, uint8_t ccId) {
+    PROFILE_SCOPE("ReportRsrp");
+    double time = Simulator::Now().GetSeconds();
+    rsrpFile.Write({time, imsi, cellId, rsrp});
+    sinrFile.Write({time, imsi, sinr});
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (ue && sinr > 0) {
+        ue->lastSinrDb = 10.0 * std::log10(sinr);
+        kpiStats.Record(KPI_SINR, ue->ueId - 1, cellId, ue->lastSinrDb);
+    }
+}
+
+void NotifyConnectionEstablished(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
+    PROFILE_SCOPE("ConnectionEstablished");
+    cellIdFile.Write({Simulator::Now().GetSeconds(), imsi, cellId});
+    UeState* ue = ueState.FindByImsi(imsi);
+    if (!ue) return;
+    hoAnalytics.OnConnected(*ue, cellId, Simulator::Now().GetSeconds());
+    // Khởi tạo vị trí ban đầu (hoặc cell kết nối lại sau RLF / HO lỗi)
+    ue->currentCell = cellId;
+    migration.OnConnected(*ue, cellId);
+    UpdateUeColor(ue->ueId - 1, cellId);
+}
+
+void LogPosition(Ptr<MobilityModel> mobility, bool isUav, uint32_t nodeIndex) {
+    PROFILE_SCOPE("LogPosition");
+    Vector p = mobility->GetPosition();
+    (isUav ? uavPositionFile : positionFile).Write({Simulator::Now().GetSeconds(), isUav, nodeIndex, p.x, p.y, p.z});
+}
+
+void RecordThroughput(UeState* ue, double thpt) {
+    throughputFile.Write({Simulator::Now().GetSeconds(), ue->ueId, thpt});
+    ue->lastThroughput = thpt;
+    ue->thptHistory.Push(thpt);
+    kpiStats.Record(KPI_THROUGHPUT, ue->ueId - 1, ue->currentCell, thpt);
+}
+
+void CalculateThroughput(Ptr<PacketSink> sink, UeState* ue, double window) {
+    PROFILE_SCOPE("CalculateThroughput");
+    uint64_t rx = sink->GetTotalRx();
+    double thpt = (rx - ue->totalRxBytes) * 8.0 / 1e6 / window;
+    ue->totalRxBytes = rx;
+    RecordThroughput(ue, thpt);
+    // Mẫu cho bảng SINR -> throughput của radio abstract (bỏ quanh handover)
+    if (rateCalibration.Enabled() && !std::isnan(ue->lastSinrDb) && !ue->packets.hoOpen) rateCalibration.Add(ue->lastSinrDb, thpt);
+}
+
+// ==================== PATHLOSS CACHE ====================
+// Kênh phổ LTE gọi path loss cho mọi cặp phát/thu mỗi subframe (1 ms), trong khi UAV bay theo
+// waypoint và UE đi 1-2 m/s: giữa hai lần gọi hình học gần như không đổi. Loss của một cặp
+// được dùng lại khi cả hai đầu dịch chuyển chưa quá Tolerance m kể từ lần tính thật.
+// Sai số tối đa 10*n*log10((d + 2*tol)/d) dB, lớn nhất ở khoảng cách ngắn (UAV bay 30 m:
+// n = 3, tol = 0.5 m -> < 0.45 dB). Chỉ dùng với model tất định (LogDistance, Friis...).
+struct PathlossCacheStats {
+    uint64_t calls = 0, hits = 0;
+    uint64_t timed = 0;          // số lần gọi model thật được đo thời gian (lấy mẫu)
+    double timedSeconds = 0.0;
+
+    void Print(std::ostream& os, const char* name) const {
+        if (calls == 0) return;
+        uint64_t misses = calls - hits;
+        double perEval = timed ? timedSeconds / timed : 0.0;
+        // Định dạng trên stream riêng để không đổi precision / fixed của os
+        std::ostringstream line;
+        line << "Pathloss cache (" << name << "): " << calls << " pair evaluations | hit "
+             << std::setprecision(1) << std::fixed << 100.0 * hits / calls << "% | model evaluated " << misses
+             << " times (" << std::setprecision(0) << perEval * 1e9 << " ns each) | saved ~"
+             << std::setprecision(3) << hits * perEval << " s";
+        os << line.str() << std::endl;
+    }
+};
+
+PathlossCacheStats lteLossCache;        // CachedPropagationLossModel (DL + UL)
+PathlossCacheStats abstractLossCache;   // hàng UE -> mọi UAV của radio abstract
+
+// Bọc model path loss đã cấu hình (attribute "Inner"); LteHelper tạo hai bản (DL, UL) dùng chung Inner
+class CachedPropagationLossModel : public PropagationLossModel {
+public:
+    static TypeId GetTypeId() {
+        static TypeId tid = TypeId("CachedPropagationLossModel")
+            .SetParent<PropagationLossModel>()
+            .AddConstructor<CachedPropagationLossModel>()
+            .AddAttribute("Inner", "Propagation loss model whose results are cached", PointerValue(),
+                          MakePointerAccessor(&CachedPropagationLossModel::m_inner),
+                          MakePointerChecker<PropagationLossModel>())
+            .AddAttribute("Tolerance", "Displacement (m) of either node before the loss is recomputed", DoubleValue(0.5),
+                          MakeDoubleAccessor(&CachedPropagationLossModel::m_tolerance),
+                          MakeDoubleChecker<double>(0.0));
+        return tid;
+    }
+
+private:
+    struct Entry { Vector a, b; double lossDb; bool valid = false; };
+
+    // Chỉ số dày cho mỗi MobilityModel (tập node cố định trong một run): cache là ma trận
+    // m_cache[ia][ib], kích thước chặn bởi số node, không phình theo số lần gọi
+    uint32_t IndexOf(const MobilityModel* m) const {
+        if (m == m_lastModel) return m_lastIndex;   // channel duyệt mọi rx của cùng một tx liên tiếp
+        auto it = m_index.emplace(m, m_index.size()).first;
+        m_lastModel = m; m_lastIndex = it->second;
+        return it->second;
+    }
+
+    double DoCalcRxPower(double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const override {
+        lteLossCache.calls++;
+        Vector pa = a->GetPosition(), pb = b->GetPosition();
+        double tol2 = m_tolerance * m_tolerance;
+        uint32_t ia = IndexOf(PeekPointer(a)), ib = IndexOf(PeekPointer(b));
+        if (ia >= m_cache.size()) m_cache.resize(ia + 1);
+        std::vector<Entry>& row = m_cache[ia];
+        if (ib >= row.size()) row.resize(ib + 1);
+        Entry& entry = row[ib];
+        if (entry.valid && CalculateDistanceSquared(pa, entry.a) <= tol2 && CalculateDistanceSquared(pb, entry.b) <= tol2) {
+            lteLossCache.hits++;
+            return txPowerDbm - entry.lossDb;
+        }
+        // Đo thời gian 1/256 lần gọi thật: đủ ước lượng tiết kiệm mà không tốn clock mỗi lần
+        bool timed = (m_misses++ & 255) == 0;
+        auto t0 = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        double rx = m_inner->CalcRxPower(txPowerDbm, a, b);
+        if (timed) {
+            lteLossCache.timed++;
+            lteLossCache.timedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+        entry = {pa, pb, txPowerDbm - rx, true};
+        return rx;
+    }
+
+    int64_t DoAssignStreams(int64_t stream) override { return m_inner->AssignStreams(stream); }
+
+    void DoDispose() override {
+        m_cache.clear(); m_index.clear(); m_lastModel = nullptr;
+        m_inner = nullptr;
+        PropagationLossModel::DoDispose();
+    }
+
+    Ptr<PropagationLossModel> m_inner;
+    double m_tolerance = 0.5;
+    mutable uint64_t m_misses = 0;
+    mutable std::unordered_map<const MobilityModel*, uint32_t> m_index;
+    mutable const MobilityModel* m_lastModel = nullptr;
+    mutable uint32_t m_lastIndex = 0;
+    mutable std::vector<std::vector<Entry>> m_cache;   // [index tx][index rx]
+};
+NS_OBJECT_ENSURE_REGISTERED(CachedPropagationLossModel);
+
+// log10 không gọi libm để vòng của BatchLogDistanceRxDbm vector hoá được (std::log10 chỉ có bản
+// vector libmvec khi cả build bật -ffast-math). x = m * 2^e tách bằng bit IEEE-754 (x >= 1, normal),
+// ln m = 2*atanh(t), t = (m-1)/(m+1) <= 1/3, chuỗi tới t^19: sai số < 1e-11 so với std::log10
+inline double VectorLog10(double x) {
+    uint64_t bits, expBits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    expBits = 0x4330000000000000ULL | (bits >> 52);                      // 2^52 + exponent thô
+    bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;       // mantissa về [1, 2)
+    double m, e;
+    std::memcpy(&m, &bits, sizeof(m));
+    std::memcpy(&e, &expBits, sizeof(e));
+    e -= 4503599627370496.0 + 1023.0;
+    double t = (m - 1.0) / (m + 1.0), t2 = t * t;
+    double p = 1.0 / 19;
+    for (int k = 17; k >= 1; k -= 2) p = 1.0 / k + t2 * p;
+    return (2.0 * t * p + e * 0.6931471805599453) * 0.4342944819032518;
+}
+
+// GCC -O2 (profile default của ns-3) chỉ vector hoá với cost model "very-cheap", bỏ qua hai vòng này;
+// ép cost model dynamic cho riêng hàm. Đã kiểm bằng -fopt-info-vec (GCC 12, x86-64 SSE2): cả hai vòng
+// "loop vectorized using 16 byte vectors" ở -O2 và -O3. Build debug (-O0) vẫn chạy scalar.
+#if defined(__GNUC__) && !defined(__clang__)
+#define VECTORIZE_HOT __attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+#else
+#define VECTORIZE_HOT
+#endif
+
+// Rx power (dBm) từ mọi UAV tới một UE theo LogDistance: toạ độ UAV dạng SoA, hai vòng không rẽ nhánh.
+// 10*n*log10(d) = 5*n*log10(d^2) nên không cần sqrt; d < 1 m kẹp về 1 m như ReferenceDistance.
+VECTORIZE_HOT
+void BatchLogDistanceRxDbm(const double* x, const double* y, const double* z, uint32_t n, const Vector& ue,
+                           double txMinusRefDb, double exponent, double* rxDbm) {
+    double ux = ue.x, uy = ue.y, uz = ue.z;   // copy: ghi rxDbm có thể alias ue, chặn vector hoá
+    for (uint32_t c = 0; c < n; ++c) {
+        double dx = x[c] - ux, dy = y[c] - uy, dz = z[c] - uz;
+        rxDbm[c] = std::max(1.0, dx * dx + dy * dy + dz * dz);
+    }
+    double k = 5.0 * exponent;
+    for (uint32_t c = 0; c < n; ++c) rxDbm[c] = txMinusRefDb - k * VectorLog10(rxDbm[c]);
+}
+
+// ==================== ABSTRACT RADIO ====================
+// --radio=abstract: không dựng LteHelper/EPC/FlowMonitor, chỉ giữ mobility của UAV/UE.
+//  - RSRP/SINR tính từ cùng LogDistance (Exponent, ReferenceLoss) và TxPower, nhiễu = mọi UAV khác
+//  - RSRP qua bộ lọc L3 (hệ số 0.5 mỗi 200 ms như UE ns-3), A3: neighbour > serving + hysteresis
+//    liên tục TimeToTrigger thì handover, thực thi mất kAbstractHoDelay
+//  - throughput = bảng SINR -> Mb/s (--radioTable, calibrate từ run LTE); không có bảng thì dùng
+//    dung lượng cell theo hiệu suất phổ (Shannon có gap, trần CQI 15) chia đều cho UE trong cell
+// Kết quả đi qua đúng các callback của LTE (ConnectionEstablished, HandoverStart/EndOk, ReportRsrp,
+// báo cáo đo) nên MEC, migration, KPI và trace không phân biệt hai engine. Không có gói tin:
+// loss/delay/gián đoạn user-plane và flow stats để trống.
+const double kReferenceLossDb = 46.67;       // LogDistance ReferenceLoss (LTE 2 GHz), dùng chung 2 engine
+const uint32_t kAbstractRbs = 25;            // 5 MHz, băng thông mặc định của LteEnbNetDevice
+const double kAbstractNoiseDbm = -174.0 + 10.0 * std::log10(kAbstractRbs * 180e3) + 9.0;   // NF của UE = 9 dB
+const double kAbstractMeasPeriod = 0.2;      // s, chu kỳ đo / lọc L3 của UE
+const double kAbstractAttachDelay = 0.05;    // s, RRC connection lúc khởi động
+const double kAbstractHoDelay = 0.04;        // s, HandoverStart -> HandoverEndOk (RRC thật, X2)
+const double kAbstractCoreDelay = 0.003;     // s, eNB -> PGW -> mecHost cho input/output MEC
+const uint32_t kAbstractReportedCells = 4;   // neighbour mạnh nhất trong một báo cáo đo
+
+// Dung lượng một cell: hiệu suất log2(1 + SINR/gap), gap cho BER 5e-5; 11/14 symbol cho data
+void BuildCapacityTable(RateTable& table) {
+    double gap = -std::log(5.0 * 5e-5) / 1.5;
+    for (int db = -10; db <= 30; ++db) {
+        double eff = std::min(5.5547, std::log2(1.0 + std::pow(10.0, db / 10.0) / gap));
+        table.Add(db, eff < 0.1523 ? 0.0 : eff * kAbstractRbs * 12 * 11 * 1000 / 1e6);
+    }
+}
+
+class AbstractRadio {
+public:
+    void Install(const NodeContainer& enbNodes, const NodeContainer& ueNodes, const std::vector<uint16_t>& initialCell,
+                 double txPowerDbm, double exponent, double hysteresisDb, double tttMs, const std::string& table,
+                 double cacheTolerance, double stopTime) {
+        m_enabled = true;
+        m_txPowerDbm = txPowerDbm; m_exponent = exponent; m_hysteresis = hysteresisDb; m_ttt = tttMs / 1000.0;
+        m_tolerance = cacheTolerance;
+        for (uint32_t c = 0; c < enbNodes.GetN(); ++c) m_enbs.push_back(enbNodes.Get(c)->GetObject<MobilityModel>());
+        m_ues.assign(ueNodes.GetN(), UeRadio());
+        for (uint32_t i = 0; i < ueNodes.GetN(); ++i) m_ues[i].mobility = ueNodes.Get(i)->GetObject<MobilityModel>();
+        m_filtered.assign(m_ues.size() * m_enbs.size(), NAN);
+        m_rxDbm.assign(m_ues.size() * m_enbs.size(), 0.0);
+        m_uavX.assign(m_enbs.size(), 0.0); m_uavY.assign(m_enbs.size(), 0.0); m_uavZ.assign(m_enbs.size(), 0.0);
+        m_rxMw.assign(m_enbs.size(), 0.0);
+        m_cellLoad.assign(m_enbs.size() + 1, 0);
+
+        m_shared = table.empty();
+        if (m_shared) BuildCapacityTable(m_table);
+        else m_table.Load(table);
+        m_edgeRate = std::max(m_table.MinPositive(), 0.1);
+
+        for (uint32_t i = 0; i < m_ues.size(); ++i) {
+            uint16_t cell = i < initialCell.size() ? initialCell[i] : ClosestCell(i);
+            Simulator::Schedule(Seconds(kAbstractAttachDelay), &AbstractRadio::Attach, this, i, cell);
+        }
+        PeriodicSampler& sampler = PeriodicSampler::Get();
+        sampler.Register(Seconds(kAbstractMeasPeriod), Seconds(kAbstractMeasPeriod), Seconds(stopTime), [this] { Measure(); });
+        // Cùng nhịp và thời điểm bắt đầu với CalculateThroughput của LTE (app start 1 s)
+        sampler.Register(MilliSeconds(100), Seconds(1.0), Seconds(stopTime), [this] { Throughput(0.1); });
+    }
+
+    bool Enabled() const { return m_enabled; }
+
+    // Thời gian truyền một message MEC giữa UE và mecHost với throughput hiện tại của UE.
+    // Đang handover / chưa attach / SINR rơi xuống vùng 0 Mb/s: truyền ở throughput gần nhất còn > 0
+    // (không có thì throughput mép vùng phủ) sau khi chờ phần thời gian handover / attach còn lại
+    double TransferTime(const UeState& ue, uint32_t bytes) const {
+        const UeRadio& r = m_ues[ue.ueId - 1];
+        double now = Simulator::Now().GetSeconds();
+        double wait = r.inHandover ? std::max(0.0, r.hoEnd - now) : r.serving == 0 ? std::max(0.0, kAbstractAttachDelay - now) : 0.0;
+        double mbps = Rate(r);
+        if (mbps <= 0.0) mbps = r.lastRate > 0.0 ? r.lastRate : m_edgeRate;
+        return wait + bytes * 8.0 / (mbps * 1e6) + kAbstractCoreDelay;
+    }
+
+    void Report(std::ostream& os) const {
+        os << "Radio: abstract (" << (m_shared ? "built-in capacity table, shared per cell" : "calibrated SINR table")
+           << ") | " << m_measurements << " measurements | " << m_handovers << " handovers" << std::endl;
+    }
+
+private:
+    struct UeRadio {
+        Ptr<MobilityModel> mobility;
+        Vector rowPos;             // vị trí UE khi hàng m_rxDbm được tính
+        uint64_t rowEpoch = 0;     // 0 = chưa tính
+        uint16_t serving = 0;
+        double sinrDb = -10.0;
+        bool inHandover = false;
+        double hoEnd = 0.0;        // thời điểm HandoverDone của handover đang chạy
+        double lastRate = 0.0;     // Mb/s, mẫu throughput gần nhất còn > 0
+        uint16_t a3Cell = 0;       // neighbour đang thỏa A3, chờ hết TimeToTrigger
+        double a3Since = 0.0;
+    };
+
+    uint16_t ClosestCell(uint32_t slot) const {
+        Vector p = m_ues[slot].mobility->GetPosition();
+        uint16_t best = 1;
+        for (uint32_t c = 1; c < m_enbs.size(); ++c)
+            if (CalculateDistance(p, m_enbs[c]->GetPosition()) < CalculateDistance(p, m_enbs[best - 1]->GetPosition())) best = c + 1;
+        return best;
+    }
+
+    double Rate(const UeRadio& r) const {
+        if (r.serving == 0 || r.inHandover) return 0.0;
+        double mbps = m_table.Lookup(r.sinrDb);
+        if (m_shared) mbps /= std::max<uint32_t>(1, m_cellLoad[r.serving]);
+        return std::min(kDlOfferedMbps, mbps);
+    }
+
+    void Attach(uint32_t slot, uint16_t cell) {
+        m_ues[slot].serving = cell;
+        m_cellLoad[cell]++;
+        NotifyConnectionEstablished("", ueState[slot].imsi, cell, 0);
+    }
+
+    // Vị trí UAV đọc một lần mỗi bước vào mảng SoA. Có cache: chỉ cập nhật (và sang epoch mới, làm
+    // mọi hàng UE cũ hết hạn) khi có UAV đã lệch quá tolerance so với vị trí đang dùng.
+    void RefreshUavPositions() {
+        double tol2 = m_tolerance * m_tolerance;
+        bool moved = m_epoch == 0 || m_tolerance <= 0.0;
+        std::vector<Vector> now(m_enbs.size());
+        for (uint32_t c = 0; c < m_enbs.size(); ++c) {
+            now[c] = m_enbs[c]->GetPosition();
+            moved = moved || CalculateDistanceSquared(now[c], Vector(m_uavX[c], m_uavY[c], m_uavZ[c])) > tol2;
+        }
+        if (!moved) return;
+        for (uint32_t c = 0; c < m_enbs.size(); ++c) { m_uavX[c] = now[c].x; m_uavY[c] = now[c].y; m_uavZ[c] = now[c].z; }
+        m_epoch++;
+    }
+
+    void Measure() {
+        PROFILE_SCOPE("AbstractRadio::Measure");
+        double noiseMw = std::pow(10.0, kAbstractNoiseDbm / 10.0);
+        double perRe = 10.0 * std::log10(kAbstractRbs * 12.0);   // RSRP là công suất trên một RE
+        double tol2 = m_tolerance * m_tolerance;
+        uint32_t cells = m_enbs.size();
+        RefreshUavPositions();
+        for (uint32_t i = 0; i < m_ues.size(); ++i) {
+            UeRadio& r = m_ues[i];
+            if (r.serving == 0 || r.inHandover) continue;
+            m_measurements++;
+            Vector p = r.mobility->GetPosition();
+            double* rx = &m_rxDbm[i * cells];
+            abstractLossCache.calls += cells;
+            if (m_tolerance > 0.0 && r.rowEpoch == m_epoch && CalculateDistanceSquared(p, r.rowPos) <= tol2) {
+                abstractLossCache.hits += cells;
+            } else {
+                BatchLogDistanceRxDbm(m_uavX.data(), m_uavY.data(), m_uavZ.data(), cells, p,
+                                      m_txPowerDbm - kReferenceLossDb, m_exponent, rx);
+                r.rowPos = p;
+                r.rowEpoch = m_epoch;
+            }
+            double* filtered = &m_filtered[i * cells];
+            double totalMw = noiseMw;
+            for (uint32_t c = 0; c < cells; ++c) {
+                m_rxMw[c] = std::pow(10.0, rx[c] / 10.0);
+                totalMw += m_rxMw[c];
+                filtered[c] = std::isnan(filtered[c]) ? rx[c] - perRe : 0.5 * filtered[c] + 0.5 * (rx[c] - perRe);
+            }
+            uint16_t s = r.serving;
+            double sinr = m_rxMw[s - 1] / (totalMw - m_rxMw[s - 1]);
+            r.sinrDb = 10.0 * std::log10(sinr);
+            uint64_t imsi = ueState[i].imsi;
+            ReportRsrp(imsi, s, 0, rx[s - 1] - perRe, sinr, 0);
+
+            // Neighbour mạnh nhất (sau lọc L3) cho báo cáo đo và điều kiện A3
+            m_report.clear();
+            for (uint32_t c = 0; c < cells; ++c) if (c + 1 != s) m_report.push_back({c + 1, filtered[c]});
+            size_t n = std::min<size_t>(kAbstractReportedCells, m_report.size());
+            std::partial_sort(m_report.begin(), m_report.begin() + n, m_report.end(),
+                              [](const std::pair<uint16_t, double>& a, const std::pair<uint16_t, double>& b) { return a.second > b.second; });
+            m_report.resize(n);
+            ProcessMeasurementReport(imsi, filtered[s - 1], m_report);
+
+            if (n > 0 && m_report[0].second > filtered[s - 1] + m_hysteresis) {
+                if (r.a3Cell != m_report[0].first) {
+                    r.a3Cell = m_report[0].first;
+                    r.a3Since = Simulator::Now().GetSeconds();
+                    Simulator::Schedule(Seconds(m_ttt), &AbstractRadio::TimeToTriggerExpired, this, i, r.a3Cell, r.a3Since);
+                }
+            } else {
+                r.a3Cell = 0;
+            }
+        }
+    }
+
+    // A3 còn thỏa cho đúng cell đó từ lúc hẹn giờ: bắt đầu handover
+    void TimeToTriggerExpired(uint32_t slot, uint16_t cell, double since) {
+        UeRadio& r = m_ues[slot];
+        if (r.inHandover || r.a3Cell != cell || r.a3Since != since) return;
+        r.inHandover = true;
+        r.hoEnd = Simulator::Now().GetSeconds() + kAbstractHoDelay;
+        r.a3Cell = 0;
+        m_cellLoad[r.serving]--;
+        m_handovers++;
+        NotifyHandoverStartUe("", ueState[slot].imsi, r.serving, 0, cell);
+        Simulator::Schedule(Seconds(kAbstractHoDelay), &AbstractRadio::HandoverDone, this, slot, cell);
+    }
+
+    void HandoverDone(uint32_t slot, uint16_t cell) {
+        UeRadio& r = m_ues[slot];
+        r.serving = cell;
+        r.inHandover = false;
+        m_cellLoad[cell]++;
+        NotifyHandoverEndOkUe("", ueState[slot].imsi, cell, 0);
+    }
+
+    void Throughput(double window) {
+        PROFILE_SCOPE("AbstractRadio::Throughput");
+        for (uint32_t i = 0; i < m_ues.size(); ++i) {
+            double thpt = Rate(m_ues[i]);
+            if (thpt > 0.0) m_ues[i].lastRate = thpt;
+            ueState[i].totalRxBytes += (uint64_t)(thpt * 1e6 / 8.0 * window);
+            RecordThroughput(&ueState[i], thpt);
+        }
+    }
+
+    bool m_enabled = false;
+    bool m_shared = true;        // bảng là dung lượng cell (chia theo số UE) thay vì throughput từng UE
+    double m_txPowerDbm = 43.0, m_exponent = 3.0, m_hysteresis = 0.0, m_ttt = 0.0;
+    double m_tolerance = 0.0;                  // m, cache path loss (0 = tính lại mỗi bước)
+    uint64_t m_epoch = 0;                      // tăng mỗi khi toạ độ UAV dùng để tính được cập nhật
+    RateTable m_table;
+    double m_edgeRate = 0.1;                   // Mb/s, dùng khi UE chưa có mẫu throughput > 0
+    std::vector<Ptr<MobilityModel>> m_enbs;    // index = cellId - 1
+    std::vector<double> m_uavX, m_uavY, m_uavZ;
+    std::vector<UeRadio> m_ues;                // index = slot
+    std::vector<double> m_rxDbm;               // rx power mỗi UAV, [slot * cells + cellId - 1]
+    std::vector<double> m_filtered;            // RSRP sau lọc L3, cùng chỉ số
+    std::vector<double> m_rxMw;                // scratch cho một UE
+    std::vector<uint32_t> m_cellLoad;          // UE đang gắn vào mỗi cell, index = cellId
+    std::vector<std::pair<uint16_t, double>> m_report;
+    uint64_t m_measurements = 0;
+    uint32_t m_handovers = 0;
+};
+
+AbstractRadio abstractRadio;
+
+bool RadioIsAbstract() { return abstractRadio.Enabled(); }
+double RadioTransferTime(const UeState& ue, uint32_t bytes) { return abstractRadio.TransferTime(ue, bytes); }
+
+// ==================== UAV PLACEMENT ====================
+// --placement=greedy: bỏ vòng tuần tra cố định, cứ placementInterval giây đặt lại vị trí các UAV.
+//  - snapshot vị trí UE/UAV; mô hình LogDistance + dung lượng cell như radio abstract, thêm hiệu
+//    chỉnh từng UE = SINR báo cáo gần nhất - SINR mô hình ở cell đang phục vụ
+//  - ứng viên của mỗi UAV: đứng yên, 8 hướng x 2 bán kính (tối đa uavSpeed * interval), lên / xuống;
+//    độ cao kẹp trong [uavMinAltitude, uavMaxAltitude], mặt phẳng kẹp trong vùng có UE
+//  - điểm = tổng throughput ước lượng (UE gắn cell mạnh nhất, dung lượng chia đều trong cell). Ứng viên
+//    của mọi UAV được chấm song song trên placementJobs thread với bố trí hiện tại, sau đó nhận lần lượt
+//    bước tốt nhất của từng UAV nếu chấm lại trên bố trí đã cập nhật vẫn còn lợi
+//  - UAV bay thẳng tới đích với uavSpeed (WaypointMobilityModel), tới nơi trước lần đặt kế tiếp
+const double kPlacementMinGain = 1e-3;        // lợi tương đối tối thiểu để nhận một bước (tránh rung)
+const double kPlacementMaxSinrOffset = 10.0;  // dB, trần hiệu chỉnh SINR báo cáo - mô hình
+
+class PlacementController {
+public:
+    void Install(const NodeContainer& enbNodes, const NodeContainer& ueNodes, double txPowerDbm, double exponent,
+                 double interval, double speed, double minAltitude, double maxAltitude, uint32_t jobs, double stopTime) {
+        NS_ABORT_MSG_IF(speed <= 0.0 || interval <= 0.0, "Placement needs a positive uavSpeed and placementInterval");
+        NS_ABORT_MSG_IF(minAltitude > maxAltitude, "uavMinAltitude is above uavMaxAltitude");
+        m_enabled = true;
+        m_txMinusRefDb = txPowerDbm - kReferenceLossDb; m_exponent = exponent;
+        m_interval = interval; m_speed = speed; m_minZ = minAltitude; m_maxZ = maxAltitude;
+        m_jobs = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        for (uint32_t c = 0; c < enbNodes.GetN(); ++c) {
+            Ptr<WaypointMobilityModel> wp = enbNodes.Get(c)->GetObject<WaypointMobilityModel>();
+            NS_ABORT_MSG_IF(!wp, "Placement needs WaypointMobilityModel on every UAV");
+            m_uavs.push_back(wp);
+        }
+        for (uint32_t i = 0; i < ueNodes.GetN(); ++i) m_ues.push_back(ueNodes.Get(i)->GetObject<MobilityModel>());
+        BuildCapacityTable(m_table);
+        PeriodicSampler::Get().Register(Seconds(interval), Seconds(interval), Seconds(stopTime), [this] { Step(); });
+    }
+
+    bool Enabled() const { return m_enabled; }
+
+    // Một run không có đối chứng tuần tra cố định: chỉ báo điểm mô hình trước / sau mỗi bước.
+    // Lợi về throughput đo được, tỉ lệ HO và latency MEC so với tuần tra lấy từ sweep off,greedy
+    void Report(std::ostream& os) const {
+        if (!m_enabled) return;
+        os << "Placement: greedy every " << m_interval << " s on " << m_jobs << " threads | " << m_steps << " steps, "
+           << m_moves << " moves, " << m_flown << " m flown | model throughput per step "
+           << (m_steps ? m_scoreBefore / m_steps : 0.0) << " -> " << (m_steps ? m_scoreAfter / m_steps : 0.0)
+           << " Mb/s | " << m_evaluations << " candidates scored in " << m_scoreSeconds << " s" << std::endl;
+        os << "Placement: no static-patrol baseline in a single run (no HO-rate or MEC-latency gain); run "
+           << "--sweep=true --sweepPlacement=off,greedy for sweep_placement_gains.csv" << std::endl;
+    }
+
+private:
+    struct Candidate { uint32_t uav; Vector pos; double score; };
+
+    void Step() {
+        PROFILE_SCOPE("PlacementController::Step");
+        Snapshot();
+        double before = Score(m_x, m_y, m_z);
+
+        // Ứng viên của mọi UAV trên cùng bố trí hiện tại: độc lập nhau nên chấm song song được
+        double reach = m_speed * m_interval;
+        std::vector<Candidate> candidates;
+        for (uint32_t u = 0; u < m_uavs.size(); ++u) {
+            Vector cur(m_x[u], m_y[u], m_z[u]);
+            candidates.push_back({u, Clip(cur), 0.0});
+            for (double r : {reach, reach / 2})
+                for (uint32_t k = 0; k < 8; ++k)
+                    candidates.push_back({u, Clip(Vector(cur.x + r * std::cos(k * M_PI / 4), cur.y + r * std::sin(k * M_PI / 4), cur.z)), 0.0});
+            candidates.push_back({u, Clip(Vector(cur.x, cur.y, cur.z + reach / 2)), 0.0});
+            candidates.push_back({u, Clip(Vector(cur.x, cur.y, cur.z - reach / 2)), 0.0});
+        }
+        ScoreAll(candidates);
+
+        // Nhận bước tốt nhất trước; mỗi bước chấm lại trên bố trí đã có các UAV nhận trước đó
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+        std::vector<double> x = m_x, y = m_y, z = m_z;
+        std::vector<bool> decided(m_uavs.size(), false);
+        double current = before;
+        for (const Candidate& cand : candidates) {
+            if (decided[cand.uav] || cand.score <= before * (1.0 + kPlacementMinGain)) continue;
+            double ox = x[cand.uav], oy = y[cand.uav], oz = z[cand.uav];
+            x[cand.uav] = cand.pos.x; y[cand.uav] = cand.pos.y; z[cand.uav] = cand.pos.z;
+            double score = Score(x, y, z);
+            m_evaluations++;
+            if (score > current * (1.0 + kPlacementMinGain)) { current = score; decided[cand.uav] = true; }
+            else { x[cand.uav] = ox; y[cand.uav] = oy; z[cand.uav] = oz; }
+        }
+
+        double now = Simulator::Now().GetSeconds();
+        for (uint32_t u = 0; u < m_uavs.size(); ++u) {
+            Vector from(m_x[u], m_y[u], m_z[u]), to(x[u], y[u], z[u]);
+            double dist = CalculateDistance(from, to);
+            // UAV không di chuyển: giữ nguyên waypoint (đang đứng yên, hoặc bay nốt bước trước). Riêng lần
+            // đầu vẫn phải xoá waypoint tuần tra để UAV đứng yên tại chỗ
+            if (dist > 0.01 || m_steps == 0) {
+                m_uavs[u]->EndMobility();
+                m_uavs[u]->AddWaypoint(Waypoint(Seconds(now), from));
+            }
+            if (dist > 0.01) {
+                m_uavs[u]->AddWaypoint(Waypoint(Seconds(now + dist / m_speed), to));
+                m_moves++;
+                m_flown += dist;
+            }
+            placementFile.Write({now, (uint16_t)(u + 1), from.x, from.y, from.z, to.x, to.y, to.z, before, current});
+        }
+        m_steps++;
+        m_scoreBefore += before;
+        m_scoreAfter += current;
+    }
+
+    // Vị trí UAV/UE, vùng có UE và hiệu chỉnh SINR từng UE tại thời điểm quyết định
+    void Snapshot() {
+        uint32_t cells = m_uavs.size();
+        m_x.resize(cells); m_y.resize(cells); m_z.resize(cells);
+        for (uint32_t c = 0; c < cells; ++c) {
+            Vector p = m_uavs[c]->GetPosition();
+            m_x[c] = p.x; m_y[c] = p.y; m_z[c] = p.z;
+        }
+        m_uePos.resize(m_ues.size());
+        m_sinrOffset.assign(m_ues.size(), 0.0);
+        m_minX = m_minY = INFINITY; m_maxX = m_maxY = -INFINITY;
+        std::vector<double> rx(cells);
+        for (uint32_t i = 0; i < m_ues.size(); ++i) {
+            m_uePos[i] = m_ues[i]->GetPosition();
+            m_minX = std::min(m_minX, m_uePos[i].x); m_maxX = std::max(m_maxX, m_uePos[i].x);
+            m_minY = std::min(m_minY, m_uePos[i].y); m_maxY = std::max(m_maxY, m_uePos[i].y);
+            const UeState& ue = ueState[i];
+            if (ue.currentCell == 0 || ue.currentCell > cells || std::isnan(ue.lastSinrDb)) continue;
+            BatchLogDistanceRxDbm(m_x.data(), m_y.data(), m_z.data(), cells, m_uePos[i], m_txMinusRefDb, m_exponent, rx.data());
+            double model = SinrDb(rx.data(), ue.currentCell - 1);
+            m_sinrOffset[i] = std::max(-kPlacementMaxSinrOffset, std::min(kPlacementMaxSinrOffset, ue.lastSinrDb - model));
+        }
+    }
+
+    Vector Clip(const Vector& p) const {
+        return Vector(std::max(m_minX, std::min(m_maxX, p.x)), std::max(m_minY, std::min(m_maxY, p.y)),
+                      std::max(m_minZ, std::min(m_maxZ, p.z)));
+    }
+
+    // SINR (dB) ở cell `serving` (index 0) từ rx power (dBm) của mọi UAV
+    double SinrDb(const double* rx, uint32_t serving) const {
+        uint32_t cells = m_uavs.size();
+        double totalMw = std::pow(10.0, kAbstractNoiseDbm / 10.0);
+        for (uint32_t c = 0; c < cells; ++c) totalMw += std::pow(10.0, rx[c] / 10.0);
+        double servingMw = std::pow(10.0, rx[serving] / 10.0);
+        return 10.0 * std::log10(servingMw / (totalMw - servingMw));
+    }
+
+    // Tổng throughput ước lượng (Mb/s) của một bố trí. Chỉ đọc snapshot, không gọi ns-3: an toàn đa luồng.
+    double Score(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z) const {
+        uint32_t cells = m_uavs.size();
+        std::vector<double> rx(cells), sinrDb(m_uePos.size());
+        std::vector<uint32_t> best(m_uePos.size()), load(cells, 0);
+        for (uint32_t i = 0; i < m_uePos.size(); ++i) {
+            BatchLogDistanceRxDbm(x.data(), y.data(), z.data(), cells, m_uePos[i], m_txMinusRefDb, m_exponent, rx.data());
+            best[i] = std::max_element(rx.begin(), rx.end()) - rx.begin();
+            load[best[i]]++;
+            sinrDb[i] = SinrDb(rx.data(), best[i]) + m_sinrOffset[i];
+        }
+        double total = 0.0;
+        for (uint32_t i = 0; i < m_uePos.size(); ++i) total += std::min(kDlOfferedMbps, m_table.Lookup(sinrDb[i]) / load[best[i]]);
+        return total;
+    }
+
+    // Chấm mọi ứng viên trên m_jobs thread, mỗi thread một phần xen kẽ của danh sách
+    void ScoreAll(std::vector<Candidate>& candidates) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto work = [this, &candidates](uint32_t first) {
+            std::vector<double> x = m_x, y = m_y, z = m_z;
+            for (size_t k = first; k < candidates.size(); k += m_jobs) {
+                Candidate& cand = candidates[k];
+                x[cand.uav] = cand.pos.x; y[cand.uav] = cand.pos.y; z[cand.uav] = cand.pos.z;
+                cand.score = Score(x, y, z);
+                x[cand.uav] = m_x[cand.uav]; y[cand.uav] = m_y[cand.uav]; z[cand.uav] = m_z[cand.uav];
+            }
+        };
+        uint32_t threads = std::min<size_t>(m_jobs, candidates.size());
+        std::vector<std::thread> pool;
+        for (uint32_t t = 1; t < threads; ++t) pool.emplace_back(work, t);
+        work(0);
+        for (std::thread& t : pool) t.join();
+        m_evaluations += candidates.size();
+        m_scoreSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    bool m_enabled = false;
+    double m_txMinusRefDb = 0.0, m_exponent = 3.0;
+    double m_interval = 5.0, m_speed = 10.0, m_minZ = 0.0, m_maxZ = 0.0;
+    uint32_t m_jobs = 1;
+    RateTable m_table;
+    std::vector<Ptr<WaypointMobilityModel>> m_uavs;   // index = cellId - 1
+    std::vector<Ptr<MobilityModel>> m_ues;            // index = slot
+    // Snapshot của lần đặt hiện tại
+    std::vector<double> m_x, m_y, m_z;
+    std::vector<Vector> m_uePos;
+    std::vector<double> m_sinrOffset;
+    double m_minX = 0.0, m_maxX = 0.0, m_minY = 0.0, m_maxY = 0.0;
+    // Thống kê
+    uint32_t m_steps = 0, m_moves = 0;
+    uint64_t m_evaluations = 0;
+    double m_flown = 0.0, m_scoreBefore = 0.0, m_scoreAfter = 0.0, m_scoreSeconds = 0.0;
+};
+
+PlacementController uavPlacement;
+
+// ==================== SCENARIO ====================
+// Tham số của một lần chạy. Các giá trị mặc định = kịch bản gốc.
+struct ScenarioConfig {
+    double simTime = 99.0;
+    double hysteresis = 0.1;         // dB
+    double timeToTriggerMs = 20.0;   // ms
+    double pathlossExponent = 3.0;
+    double txPower = 43.0;           // dBm
+    uint32_t seed = 12345;
+    uint32_t run = 1;
+    std::string traceFormat = "csv";
+    uint32_t traceBatch = 4096;
+    bool traceAsync = true;
+    std::string animation = "full";  // off | positions | full
+    double animInterval = 1.0;       // s giữa 2 keyframe (positions)
+    double animMinMove = 0.5;        // m, node di chuyển ít hơn thì bỏ keyframe
+    bool animGzip = false;
+    bool profile = false;            // self-profiler: chi phí từng callback, events/s, RSS
+    double profileInterval = 1.0;    // s mô phỏng giữa 2 mẫu timeline
+    bool rawTraces = false;          // ghi từng mẫu RSRP/SINR/throughput/vị trí ra file
+    double kpiInterval = 0.0;        // s, 0 = chỉ tổng kết cuối
+    std::string radio = "lte";       // lte (LteHelper + EPC đầy đủ) | abstract (SINR -> throughput tra bảng)
+    std::string radioTable;          // abstract: bảng SINR -> throughput; trống = dung lượng cell dựng sẵn
+    std::string radioTableOut;       // lte: ghi bảng calibrate cho abstract ra file này
+    double pathlossCache = 0.0;      // m, dùng lại path loss khi UAV/UE dịch chuyển ít hơn (0 = tắt)
+    uint32_t rlcBufferBytes = 0;     // buffer RLC UM mỗi bearer (0 = mặc định ns-3, chỉ nâng khi burst MEC cần)
+    double pingPongWindow = 1.0;     // s, HO quay về cell vừa rời trong khoảng này = ping-pong
+    double hoFailureWindow = 1.0;    // s, RLF trong khoảng này sau HO = too-early / wrong-cell
+    // Topology: numUavs = 0 -> kịch bản gốc 3 UAV / 3 UE viết tay
+    uint32_t numUavs = 0;
+    uint32_t numUes = 0;
+    double cellSpacing = 140.0;      // m, khoảng cách tâm tuần tra giữa 2 UAV kề nhau
+    double uavAltitude = 30.0;       // m
+    double patrolRadius = 40.0;      // m
+    double patrolPeriod = 100.0;     // s cho một vòng tuần tra
+    double staticFraction = 0.2;     // tỉ lệ UE đứng yên
+    double vehicularFraction = 0.2;  // tỉ lệ UE đi xe (RandomWaypoint 8-15 m/s), còn lại đi bộ
+    // Trace ghi sẵn (đọc dần theo thời gian mô phỏng), chỉ với topology sinh tự động
+    std::string uavTrace;            // mobility UAV: ns-2 setdest hoặc CSV Time,NodeId,X,Y[,Z]
+    std::string ueTrace;             // mobility UE, cùng định dạng
+    std::string taskTrace;           // task MEC: CSV Time,NodeId (thay cho mecArrival)
+    double traceHorizon = 10.0;      // s, đọc trước trace mobility bao xa
+    std::string placement = "off";   // off (tuần tra cố định) | greedy (đặt lại vị trí UAV theo UE)
+    double placementInterval = 5.0;  // s giữa 2 lần đặt vị trí
+    uint32_t placementJobs = 0;      // thread chấm điểm ứng viên (0 = mọi core)
+    double uavSpeed = 10.0;          // m/s, tốc độ bay khi đổi vị trí
+    double uavMinAltitude = 20.0;    // m
+    double uavMaxAltitude = 120.0;   // m
+    MecConfig mec;
+    TrafficConfig traffic;
+};
+
+// Gán một tham số theo tên (tên trùng option CLI). Trả về false nếu không biết key.
+bool ApplyScenarioKey(ScenarioConfig& cfg, const std::string& key, const std::string& value) {
+    if (key == "simTime") cfg.simTime = std::stod(value);
+    else if (key == "hysteresis") cfg.hysteresis = std::stod(value);
+    else if (key == "timeToTrigger") cfg.timeToTriggerMs = std::stod(value);
+    else if (key == "exponent") cfg.pathlossExponent = std::stod(value);
+    else if (key == "txPower") cfg.txPower = std::stod(value);
+    else if (key == "animation") cfg.animation = value;
+    else if (key == "animInterval") cfg.animInterval = std::stod(value);
+    else if (key == "animMinMove") cfg.animMinMove = std::stod(value);
+    else if (key == "animGzip") cfg.animGzip = (value == "true" || value == "1");
+    else if (key == "profile") cfg.profile = (value == "true" || value == "1");
+    else if (key == "profileInterval") cfg.profileInterval = std::stod(value);
+    else if (key == "rawTraces") cfg.rawTraces = (value == "true" || value == "1");
+    else if (key == "kpiInterval") cfg.kpiInterval = std::stod(value);
+    else if (key == "radio") cfg.radio = value;
+    else if (key == "radioTable") cfg.radioTable = value;
+    else if (key == "radioTableOut") cfg.radioTableOut = value;
+    else if (key == "pathlossCache") cfg.pathlossCache = std::stod(value);
+    else if (key == "rlcBuffer") cfg.rlcBufferBytes = std::stoul(value);
+    else if (key == "pingPongWindow") cfg.pingPongWindow = std::stod(value);
+    else if (key == "hoFailureWindow") cfg.hoFailureWindow = std::stod(value);
+    else if (key == "numUavs") cfg.numUavs = std::stoul(value);
+    else if (key == "numUes") cfg.numUes = std::stoul(value);
+    else if (key == "cellSpacing") cfg.cellSpacing = std::stod(value);
+    else if (key == "uavAltitude") cfg.uavAltitude = std::stod(value);
+    else if (key == "patrolRadius") cfg.patrolRadius = std::stod(value);
+    else if (key == "patrolPeriod") cfg.patrolPeriod = std::stod(value);
+    else if (key == "staticFraction") cfg.staticFraction = std::stod(value);
+    else if (key == "vehicularFraction") cfg.vehicularFraction = std::stod(value);
+    else if (key == "uavTrace") cfg.uavTrace = value;
+    else if (key == "ueTrace") cfg.ueTrace = value;
+    else if (key == "taskTrace") cfg.taskTrace = value;
+    else if (key == "traceHorizon") cfg.traceHorizon = std::stod(value);
+    else if (key == "placement") cfg.placement = value;
+    else if (key == "placementInterval") cfg.placementInterval = std::stod(value);
+    else if (key == "placementJobs") cfg.placementJobs = std::stoul(value);
+    else if (key == "uavSpeed") cfg.uavSpeed = std::stod(value);
+    else if (key == "uavMinAltitude") cfg.uavMinAltitude = std::stod(value);
+    else if (key == "uavMaxAltitude") cfg.uavMaxAltitude = std::stod(value);
+    else if (key == "mecCores") cfg.mec.cores = std::stoul(value);
+    else if (key == "mecClock") cfg.mec.clockMHz = std::stod(value);
+    else if (key == "mecDiscipline") cfg.mec.discipline = value;
+    else if (key == "mecInputBytes") cfg.mec.inputBytes = std::stoul(value);
+    else if (key == "mecOutputBytes") cfg.mec.outputBytes = std::stoul(value);
+    else if (key == "mecMcycles") cfg.mec.mcycles = std::stod(value);
+    else if (key == "localClock") cfg.mec.localClockMHz = std::stod(value);
+    else if (key == "mecInterval") cfg.mec.interval = std::stod(value);
+    else if (key == "mecArrival") cfg.mec.arrival = value;
+    else if (key == "mecDeadline") cfg.mec.deadline = std::stod(value);
+    else if (key == "mecTimeout") cfg.mec.timeout = std::stod(value);
+    else if (key == "mecPriorityClasses") cfg.mec.priorityClasses = std::stoul(value);
+    else if (key == "offloadPolicy") cfg.mec.policy = value;
+    else if (key == "throughputPredictor") cfg.mec.predictor = value;
+    else if (key == "offloadThreshold") cfg.mec.thresholdMbps = std::stod(value);
+    else if (key == "energyWeight") cfg.mec.energyWeight = std::stod(value);
+    else if (key == "predictorWindow") cfg.mec.predictorWindow = std::stoul(value);
+    else if (key == "ewmaAlpha") cfg.mec.ewmaAlpha = std::stod(value);
+    else if (key == "ueKappa") {
+        cfg.mec.ueKappa = std::stod(value);
+        NS_ABORT_MSG_IF(cfg.mec.ueKappa <= 0.0, "ueKappa must be > 0");
+    }
+    else if (key == "uavKappa") cfg.mec.uavKappa = std::stod(value);
+    else if (key == "ueTxPowerW") cfg.mec.ueTxPowerW = std::stod(value);
+    else if (key == "ueRxPowerW") cfg.mec.ueRxPowerW = std::stod(value);
+    else if (key == "traffic") cfg.traffic.profile = value;
+    else if (key == "staticTraffic") cfg.traffic.staticProfile = value;
+    else if (key == "vehicularTraffic") cfg.traffic.vehicularProfile = value;
+    else if (key == "pedestrianTraffic") cfg.traffic.pedestrianProfile = value;
+    else if (key == "trafficRate") cfg.traffic.rateMbps = std::stod(value);
+    else if (key == "onTime") cfg.traffic.onTime = std::stod(value);
+    else if (key == "offTime") cfg.traffic.offTime = std::stod(value);
+    else if (key == "burstBytes") cfg.traffic.burstBytes = std::stoul(value);
+    else if (key == "burstInterval") cfg.traffic.burstInterval = std::stod(value);
+    else if (key == "rampStep") cfg.traffic.rampStepMbps = std::stod(value);
+    else if (key == "rampInterval") cfg.traffic.rampInterval = std::stod(value);
+    else if (key == "lossThreshold") cfg.traffic.lossThreshold = std::stod(value);
+    else if (key == "ulRate") cfg.traffic.ulRateMbps = std::stod(value);
+    else if (key == "capacityInterval") cfg.traffic.capacityInterval = std::stod(value);
+    else if (key == "migration") cfg.mec.migration = value;
+    else if (key == "migrationStateBytes") cfg.mec.stateBytes = std::stoul(value);
+    else if (key == "migrationDirtyFraction") cfg.mec.dirtyFraction = std::stod(value);
+    else if (key == "precopyMargin") cfg.mec.precopyMarginDb = std::stod(value);
+    else if (key == "x2Rate") cfg.mec.x2RateMbps = std::stod(value);
+    else if (key == "x2Delay") cfg.mec.x2DelayMs = std::stod(value);
+    else return false;
+    return true;
+}
+
+// File scenario: mỗi dòng "key = value", '#' là comment. Key trùng tên option CLI.
+// Bỏ khoảng trắng hai đầu, giữ nguyên khoảng trắng bên trong (đường dẫn có dấu cách)
+std::string Trim(const std::string& text) {
+    const char* spaces = " \t\r\n\f\v";
+    size_t first = text.find_first_not_of(spaces);
+    if (first == std::string::npos) return "";
+    return text.substr(first, text.find_last_not_of(spaces) - first + 1);
+}
+
+void LoadScenarioFile(const std::string& path, ScenarioConfig& cfg) {
+    std::ifstream in(path);
+    NS_ABORT_MSG_IF(!in.is_open(), "Cannot open scenario file " << path);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = Trim(line.substr(0, eq)), value = Trim(line.substr(eq + 1));
+        if (key.empty() || value.empty()) continue;
+        NS_ABORT_MSG_IF(!ApplyScenarioKey(cfg, key, value), "Unknown scenario key '" << key << "' in " << path);
+    }
+}
+
+// ==================== TRACE INPUT ====================
+// Mobility UAV/UE và thời điểm sinh task MEC đọc từ file ghi sẵn, đọc tuần tự theo thời gian mô phỏng.
+// Không nạp cả file: mỗi lần chỉ đọc các dòng có thời điểm <= now + horizon rồi đẩy waypoint vào
+// WaypointMobilityModel; state giữ lại là O(số node), không phụ thuộc độ dài trace.
+// Định dạng mobility (nhận dạng theo từng dòng, file phải tăng dần theo thời gian):
+//  - ns-2 (BonnMotion, setdest): `$node_(i) set X_ x` / Y_ / Z_ và `$ns_ at t "$node_(i) setdest x y speed"`
+//  - CSV: `Time,NodeId,X,Y[,Z]`, mỗi dòng là một waypoint (nội suy tuyến tính giữa các dòng)
+// NodeId bắt đầu từ 0 như ns-2. ns-2 là 2D: Z_ = 0 hoặc không có thì dùng độ cao mặc định của loại node.
+class MobilityTraceFeeder {
+public:
+    void Open(const std::string& path, const NodeContainer& nodes, double defaultZ, double horizon, double stopTime, const char* what) {
+        m_in.open(path);
+        NS_ABORT_MSG_IF(!m_in.is_open(), "Cannot open mobility trace " << path);
+        m_path = path; m_what = what; m_defaultZ = defaultZ; m_horizon = horizon;
+        m_tracks.assign(nodes.GetN(), Track());
+        for (uint32_t i = 0; i < nodes.GetN(); ++i) {
+            m_tracks[i].wp = nodes.Get(i)->GetObject<WaypointMobilityModel>();
+            m_tracks[i].pos = Vector(0.0, 0.0, defaultZ);
+            NS_ABORT_MSG_IF(!m_tracks[i].wp, "Trace-driven " << what << " need WaypointMobilityModel");
+        }
+        // Đợt đầu chạy ngay lúc setup để vị trí ban đầu có trước khi attach
+        Feed(horizon);
+        PeriodicSampler::Get().Register(Seconds(horizon / 2), Seconds(horizon / 2), Seconds(stopTime),
+                                        [this] { Feed(Simulator::Now().GetSeconds() + m_horizon); });
+    }
+
+    void Report(std::ostream& os) const {
+        if (m_path.empty()) return;
+        os << "Mobility trace (" << m_what << "): " << m_path << " | " << m_lines << " lines, " << m_waypoints
+           << " waypoints in " << m_batches << " batches (lookahead " << m_horizon << " s)";
+        if (m_skipped) os << " | " << m_skipped << " unrecognised lines skipped";
+        os << std::endl;
+    }
+
+private:
+    struct Track {
+        Ptr<WaypointMobilityModel> wp;
+        Vector pos;                  // vị trí tại `time` (đầu đoạn đang bay nếu moving)
+        double time = 0.0;
+        bool placed = false, emitted = false;   // đã có vị trí ban đầu / đã đẩy waypoint nào
+        double lastEmit = 0.0;
+        bool moving = false;         // đoạn setdest chưa kết thúc
+        Vector dest;
+        double arrival = 0.0;
+    };
+    struct Command { double time = 0.0; uint32_t node = 0; char kind = 0; Vector v; double speed = 0.0; };   // kind: X/Y/Z, 'd' setdest, 'p' waypoint
+
+    // Đọc mọi lệnh có thời điểm <= until, rồi chốt waypoint của các đoạn đang bay tới until
+    void Feed(double until) {
+        PROFILE_SCOPE("MobilityTraceFeeder::Feed");
+        m_batches++;
+        while (m_hasPending || Read(m_pending)) {
+            m_hasPending = true;
+            if (m_pending.time > until) break;
+            m_hasPending = false;
+            Apply(m_pending);
+        }
+        for (Track& t : m_tracks) {
+            if (!t.emitted && t.placed) Emit(t, 0.0, t.pos);
+            if (!t.moving) continue;
+            if (t.arrival <= until) {
+                Emit(t, t.arrival, t.dest);
+                t.pos = t.dest; t.time = t.arrival; t.moving = false;
+            } else {
+                // Chưa biết lệnh kế tiếp sau until: chia đoạn để model luôn có waypoint phía trước
+                t.pos = PositionAt(t, until); t.time = until;
+                Emit(t, until, t.pos);
+            }
+        }
+    }
+
+    void Apply(const Command& c) {
+        NS_ABORT_MSG_IF(c.node >= m_tracks.size(), "Mobility trace " << m_path << " uses node " << c.node
+                        << " but only " << m_tracks.size() << " " << m_what << " exist (set numUavs / numUes)");
+        NS_ABORT_MSG_IF(c.time < m_lastTime, "Mobility trace " << m_path << " is not sorted by time at line " << m_lines);
+        m_lastTime = c.time;
+        Track& t = m_tracks[c.node];
+        if (c.kind == 'X' || c.kind == 'Y' || c.kind == 'Z') {
+            if (c.kind == 'X') t.pos.x = c.v.x;
+            else if (c.kind == 'Y') t.pos.y = c.v.x;
+            else t.pos.z = c.v.x != 0.0 ? c.v.x : m_defaultZ;
+            t.placed = true;
+            return;
+        }
+        if (c.kind == 'p') {
+            t.moving = false;
+            t.pos = c.v; t.time = c.time; t.placed = true;
+            Emit(t, c.time, c.v);
+            return;
+        }
+        // setdest: đoạn trước (nếu có) kết thúc tại c.time hoặc lúc đã tới đích
+        if (!t.emitted) Emit(t, 0.0, t.pos);
+        if (t.moving && t.arrival <= c.time) {
+            Emit(t, t.arrival, t.dest);
+            t.pos = t.dest; t.time = t.arrival; t.moving = false;
+        }
+        Vector start = PositionAt(t, c.time);
+        Emit(t, c.time, start);
+        Vector dest(c.v.x, c.v.y, start.z);
+        double dist = CalculateDistance(start, dest);
+        t.pos = start; t.time = c.time;
+        t.moving = c.speed > 0.0 && dist > 0.0;
+        t.dest = dest;
+        t.arrival = t.moving ? c.time + dist / c.speed : c.time;
+    }
+
+    static Vector PositionAt(const Track& t, double time) {
+        if (!t.moving || time <= t.time) return t.pos;
+        if (time >= t.arrival) return t.dest;
+        double f = (time - t.time) / (t.arrival - t.time);
+        return Vector(t.pos.x + f * (t.dest.x - t.pos.x), t.pos.y + f * (t.dest.y - t.pos.y), t.pos.z + f * (t.dest.z - t.pos.z));
+    }
 
-    if (IsPingPongHandover(imsi, cellId)) pingPongHandoverCount++;
-    
-    ueHandoverHistory[imsi].push_back(cellId);
-    if (ueHandoverHistory[imsi].size() > 3) ueHandoverHistory[imsi].pop_front();
-    
-    if (lastHandoverEvent.find(imsi) != lastHandoverEvent.end()) {
-        HandoverEvent& ev = lastHandoverEvent[imsi];
-        double duration = time - ev.time;
-        double degradation = 0.0;
-        if (ev.throughputBefore > 0) degradation = (ev.throughputBefore - lastThroughput[imsi])/ev.throughputBefore*100.0;
-        
-        handoverQualityFile << time << "," << imsi << "," << ev.sourceCellId << ","
-                           << ev.targetCellId << ",No," << duration << "," 
-                           << ev.throughputBefore << "," << lastThroughput[imsi] << "," << degradation << std::endl;
-        
-        hoTraceFile << time << "," << imsi << "," << ev.sourceCellId << "," << ev.targetCellId << std::endl;
-        
-        std::cout << "   [HO SUCCESS] Time: " << std::fixed << std::setprecision(2) << time 
-                  << "s | UE" << imsi << " switched: Cell " << ev.sourceCellId 
-                  << " --> Cell " << ev.targetCellId << std::endl;
+    void Emit(Track& t, double time, const Vector& pos) {
+        if (t.emitted && time < t.lastEmit) return;
+        t.wp->AddWaypoint(Waypoint(Seconds(time), pos));
+        t.emitted = true;
+        t.lastEmit = time;
+        m_waypoints++;
     }
-    handoverFile << time << "," << imsi << "," << cellId << "," << handoverCount << ",0" << std::endl;
-    
-    UpdateUeColor(imsi - 1, cellId);
-}
 
-void RecvMeasurementReportCallback(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti, LteRrcSap::MeasurementReport report) {
-    double time = Simulator::Now().GetSeconds();
-    if (report.measResults.haveMeasResultNeighCells) {
-        for (auto it = report.measResults.measResultListEutra.begin(); it != report.measResults.measResultListEutra.end(); ++it) {
-            if (it->haveRsrpResult) {
-                double rsrp = -140.0 + (double)it->rsrpResult;
-                rsrpFile << time << "," << imsi << "," << it->physCellId << "," << rsrp << std::endl;
+    // Dòng kế tiếp có nghĩa; false khi hết file
+    bool Read(Command& c) {
+        char axis = 0;
+        double x = 0.0, y = 0.0, z = 0.0;
+        while (std::getline(m_in, m_line)) {
+            m_lines++;
+            const char* s = m_line.c_str();
+            while (*s == ' ' || *s == '\t') ++s;
+            if (*s == '\0' || *s == '#' || *s == '\r') continue;
+            if (std::sscanf(s, "$ns_ at %lf \"$node_(%u) setdest %lf %lf %lf", &c.time, &c.node, &x, &y, &c.speed) == 5) {
+                c.kind = 'd'; c.v = Vector(x, y, 0.0);
+                return true;
+            }
+            if (std::sscanf(s, "$node_(%u) set %c_ %lf", &c.node, &axis, &x) == 3 && (axis == 'X' || axis == 'Y' || axis == 'Z')) {
+                c.time = m_lastTime; c.kind = axis; c.v = Vector(x, 0.0, 0.0);
+                return true;
             }
+            int n = std::sscanf(s, "%lf,%u,%lf,%lf,%lf", &c.time, &c.node, &x, &y, &z);
+            if (n >= 4) {
+                c.kind = 'p'; c.v = Vector(x, y, n == 5 ? z : m_defaultZ);
+                return true;
+            }
+            m_skipped++;   // header CSV, lệnh ns-2 khác
         }
+        return false;
     }
-}
 
-void ReportRsrp(uint64_t imsi, uint16_t cellId, uint16_t rnti, double rsrp, double sinr, uint8_t ccId) {
-    rsrpFile << Simulator::Now().GetSeconds() << "," << imsi << "," << cellId << "," << rsrp << std::endl;
-    sinrFile << Simulator::Now().GetSeconds() << "," << imsi << "," << sinr << std::endl;
-}
+    std::ifstream m_in;
+    std::string m_path, m_line;
+    const char* m_what = "";
+    double m_defaultZ = 0.0, m_horizon = 10.0, m_lastTime = 0.0;
+    std::vector<Track> m_tracks;   // index = thứ tự node trong container
+    Command m_pending;
+    bool m_hasPending = false;
+    uint64_t m_lines = 0, m_waypoints = 0, m_skipped = 0, m_batches = 0;
+};
 
-void NotifyConnectionEstablished(std::string path, uint64_t imsi, uint16_t cellId, uint16_t rnti) {
-    cellIdFile << Simulator::Now().GetSeconds() << "," << imsi << "," << cellId << std::endl;
-    // Khởi tạo vị trí ban đầu
-    ueCurrentCellMap[imsi] = cellId;
-    uePreviousMecCellMap[imsi] = cellId; 
-    UpdateUeColor(imsi - 1, cellId);
-}
+MobilityTraceFeeder uavTraceFeeder, ueTraceFeeder;
 
-void LogPositions(NodeContainer ues, NodeContainer uavs) {
-    double t = Simulator::Now().GetSeconds();
-    for (uint32_t i=0; i<ues.GetN(); ++i) {
-        Vector p = ues.Get(i)->GetObject<MobilityModel>()->GetPosition();
-        positionFile << t << ",UE" << (i+1) << "," << p.x << "," << p.y << "," << p.z << std::endl;
+// Task MEC theo trace `Time,NodeId` (NodeId từ 0, tăng dần theo thời gian): chỉ giữ một event
+// "task kế tiếp" trong scheduler, dòng sau chỉ được đọc khi task trước đã sinh.
+class TaskArrivalTrace {
+public:
+    void Open(const std::string& path, uint32_t numUes, double stopTime) {
+        m_in.open(path);
+        NS_ABORT_MSG_IF(!m_in.is_open(), "Cannot open task trace " << path);
+        m_path = path; m_numUes = numUes; m_stopTime = stopTime;
+        ScheduleNext();
     }
-    for (uint32_t i=0; i<uavs.GetN(); ++i) {
-        Vector p = uavs.Get(i)->GetObject<MobilityModel>()->GetPosition();
-        uavPositionFile << t << ",UAV" << (i+1) << "," << p.x << "," << p.y << "," << p.z << std::endl;
+
+    void Report(std::ostream& os) const {
+        if (m_path.empty()) return;
+        os << "Task trace: " << m_path << " | " << m_tasks << " tasks from " << m_lines << " lines";
+        if (m_skipped) os << " | " << m_skipped << " unrecognised lines skipped";
+        os << std::endl;
     }
-}
 
-void CalculateThroughput(Ptr<PacketSink> sink, uint32_t ueId, double window) {
-    double time = Simulator::Now().GetSeconds();
-    uint64_t rx = sink->GetTotalRx();
-    if (totalRxBytes.find(ueId) == totalRxBytes.end()) totalRxBytes[ueId] = 0;
-    double thpt = (rx - totalRxBytes[ueId]) * 8.0 / 1e6 / window;
-    throughputFile << time << "," << ueId << "," << thpt << std::endl;
-    totalRxBytes[ueId] = rx;
-    lastThroughput[ueId] = thpt;
-}
+private:
+    void ScheduleNext() {
+        double time = 0.0;
+        uint32_t node = 0;
+        while (std::getline(m_in, m_line)) {
+            m_lines++;
+            if (std::sscanf(m_line.c_str(), "%lf,%u", &time, &node) != 2) { m_skipped++; continue; }
+            NS_ABORT_MSG_IF(node >= m_numUes, "Task trace " << m_path << " uses UE " << node << " but only " << m_numUes << " UEs exist");
+            NS_ABORT_MSG_IF(time < m_lastTime, "Task trace " << m_path << " is not sorted by time at line " << m_lines);
+            m_lastTime = time;
+            if (time >= m_stopTime) break;
+            Simulator::Schedule(Seconds(time) - Simulator::Now(), &TaskArrivalTrace::Fire, this, node);
+            return;
+        }
+        m_in.close();
+    }
 
-// ==================== MAIN ====================
-int main(int argc, char *argv[])
-{
-    double simTime = 99.0; 
-    CommandLine cmd;
-    cmd.AddValue("simTime", "Simulation time", simTime);
-    cmd.Parse(argc, argv);
-    
-    RngSeedManager::SetSeed(12345); RngSeedManager::SetRun(1);
-    
-    std::cout << "SCENARIO: UAV-MEC Handover with Migration Penalty & FlowMonitor" << std::endl;
-    
-    // Open CSV Files
-    rsrpFile.open("scenario1_final_rsrp.csv"); rsrpFile << "Time,IMSI,CellId,RSRP" << std::endl;
-    sinrFile.open("scenario1_final_sinr.csv"); sinrFile << "Time,IMSI,SINR" << std::endl;
-    throughputFile.open("scenario1_final_throughput.csv"); throughputFile << "Time,UE_ID,Throughput_Mbps" << std::endl;
-    handoverFile.open("scenario1_final_handover.csv"); handoverFile << "Time,IMSI,TargetCellId,HandoverCount,PingPong" << std::endl;
-    positionFile.open("scenario1_final_ue_position.csv"); positionFile << "Time,NodeName,X,Y,Z" << std::endl;
-    cellIdFile.open("scenario1_final_cellid.csv"); cellIdFile << "Time,IMSI,CellId" << std::endl;
-    handoverQualityFile.open("scenario1_final_handover_quality.csv"); handoverQualityFile << "Time,IMSI,Source,Target,PingPong,Duration,TpBefore,TpAfter,Degradation" << std::endl;
-    uavPositionFile.open("scenario1_final_uav_position.csv"); uavPositionFile << "Time,NodeName,X,Y,Z" << std::endl;
-    mecOffloadFile.open("scenario1_final_mec_offload.csv"); mecOffloadFile << "Time,UE_ID,TaskID,Type,Latency,Throughput,MigrationPenalty" << std::endl;
-    hoTraceFile.open("handover_trace.csv"); hoTraceFile << "Time(s),UE_ID,From_Cell,To_Cell" << std::endl;
-    flowStatsFile.open("scenario1_final_flow_stats.csv"); flowStatsFile << "FlowID,Src,Dst,TxPkts,RxPkts,LostPkts,LossRate,Delay(ms),Jitter(ms)" << std::endl;
-
-    // LTE Configuration
-    Ptr<LteHelper> lteHelper = CreateObject<LteHelper>();
-    Ptr<PointToPointEpcHelper> epcHelper = CreateObject<PointToPointEpcHelper>();
-    lteHelper->SetEpcHelper(epcHelper);
-    lteHelper->SetAttribute("UseIdealRrc", BooleanValue(false));
-    
-    // --- TUNING HANDOVER SENSITIVITY ---
-    lteHelper->SetHandoverAlgorithmType("ns3::A3RsrpHandoverAlgorithm");
-    lteHelper->SetHandoverAlgorithmAttribute("Hysteresis", DoubleValue(0.1)); 
-    lteHelper->SetHandoverAlgorithmAttribute("TimeToTrigger", TimeValue(MilliSeconds(20))); 
-    
-    //lteHelper->SetAttribute("PathlossModel", StringValue("ns3::FriisPropagationLossModel"));
-    lteHelper->SetAttribute("PathlossModel", StringValue("ns3::LogDistancePropagationLossModel"));
-    
-    // Cấu hình môi trường truyền sóng (Exponent = 3.0 tương đương đô thị)
-    lteHelper->SetPathlossModelAttribute("Exponent", DoubleValue(3.0)); 
-    lteHelper->SetPathlossModelAttribute("ReferenceLoss", DoubleValue(46.67)); // Chuẩn LTE 2GHz
-    
-    // Network Setup
-    Ptr<Node> pgw = epcHelper->GetPgwNode();
-    NodeContainer remoteHostContainer; remoteHostContainer.Create(1);
-    Ptr<Node> remoteHost = remoteHostContainer.Get(0);
-    InternetStackHelper internet; internet.Install(remoteHostContainer);
-    PointToPointHelper p2ph;
-    p2ph.SetDeviceAttribute("DataRate", DataRateValue(DataRate("100Gb/s")));
-    p2ph.SetChannelAttribute("Delay", TimeValue(MilliSeconds(10)));
-    NetDeviceContainer internetDevices = p2ph.Install(pgw, remoteHost);
-    Ipv4AddressHelper ipv4h; ipv4h.SetBase("1.0.0.0", "255.0.0.0");
-    ipv4h.Assign(internetDevices);
-    Ipv4StaticRoutingHelper ipv4RoutingHelper;
-    ipv4RoutingHelper.GetStaticRouting(remoteHost->GetObject<Ipv4>())->AddNetworkRouteTo(Ipv4Address("7.0.0.0"), Ipv4Mask("255.0.0.0"), 1);
-    
-    MobilityHelper coreMobility;
-    Ptr<ListPositionAllocator> corePos = CreateObject<ListPositionAllocator>();
-    
-    // 1. Đặt Remote Host (Server) ở góc trên bên trái
-    corePos->Add(Vector(10, 250, 0)); 
-    
-    // 2. Đặt PGW (Gateway) thấp hơn Server một chút
-    corePos->Add(Vector(10, 200, 0));
-    
-    // 3. SGW (Serving Gateway) - do EPC Helper tự tạo, là Node số 1
-    corePos->Add(Vector(30, 180, 0));
-    
-    // 4. MME (Quản lý di động) -  do EPC Helper tự tạo, là Node số 2
-    corePos->Add(Vector(10, 160, 0));
-
-    coreMobility.SetPositionAllocator(corePos);
-    coreMobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
-    
-    // Cài đặt vị trí cho Remote Host 
-    coreMobility.Install(remoteHostContainer);
-    
-    // Cài đặt vị trí cho PGW
-    NodeContainer pgwContainer;
-    pgwContainer.Add(pgw);
-    coreMobility.Install(pgwContainer);
-    Ptr<Node> sgw = epcHelper->GetSgwNode();
-    NodeContainer sgwContainer;
-    sgwContainer.Add(sgw);
-    coreMobility.Install(sgwContainer);
-    
-    // MME là Node có ID = 2 
-    Ptr<Node> mme = NodeList::GetNode(2); 
-    NodeContainer mmeContainer;
-    mmeContainer.Add(mme);
-    // lấy vị trí thứ 4 trong ListPositionAllocator (Vector 10, 160, 0)
-    coreMobility.Install(mmeContainer);
-    
-    // Nodes
-    NodeContainer uavEnbNodes; uavEnbNodes.Create(3);
+    void Fire(uint32_t slot) {
+        m_tasks++;
+        GenerateMecTask(ueState[slot]);
+        ScheduleNext();
+    }
+
+    std::ifstream m_in;
+    std::string m_path, m_line;
+    uint32_t m_numUes = 0;
+    double m_stopTime = 0.0, m_lastTime = 0.0;
+    uint64_t m_lines = 0, m_skipped = 0, m_tasks = 0;
+};
+
+TaskArrivalTrace taskTrace;
+
+// ==================== TOPOLOGY ====================
+// Kịch bản gốc: 3 UAV tuần tra, UE1/UE3 đi bộ quanh UAV1/UAV3, UE2 đi xuyên qua các cell
+void BuildLegacyTopology(NodeContainer& uavEnbNodes) {
+    uavEnbNodes.Create(3);
     globalUeNodes.Create(3); 
     
     // Mobility: UAVs
@@ -373,151 +3529,1490 @@ int main(int argc, char *argv[])
     wp->AddWaypoint(Waypoint(Seconds(70.0), Vector(180, 180, 1.5))); 
     wp->AddWaypoint(Waypoint(Seconds(80.0), Vector(150, 200, 1.5))); 
     wp->AddWaypoint(Waypoint(Seconds(99.0), Vector(130, 220, 1.5)));
+}
+
+// Tâm vùng tuần tra của UAV thứ i trên lưới cols cột
+Vector PatrolCenter(const ScenarioConfig& cfg, uint32_t i) {
+    uint32_t cols = std::ceil(std::sqrt((double)cfg.numUavs));
+    return Vector(((i % cols) + 0.5) * cfg.cellSpacing, ((i / cols) + 0.5) * cfg.cellSpacing, cfg.uavAltitude);
+}
+
+// Kịch bản sinh tự động: N UAV trên lưới, tuần tra hình thoi; M UE chia 3 lớp di động
+void BuildGeneratedTopology(const ScenarioConfig& cfg, NodeContainer& uavEnbNodes) {
+    uint32_t cols = std::ceil(std::sqrt((double)cfg.numUavs));
+    uint32_t rows = (cfg.numUavs + cols - 1) / cols;
+    double width = cols * cfg.cellSpacing, height = rows * cfg.cellSpacing;
+    uavEnbNodes.Create(cfg.numUavs);
+    globalUeNodes.Create(cfg.numUes);
+
+    // UAV: 4 đỉnh hình thoi quanh tâm, lệch pha theo index để các UAV không bay đồng bộ
+    MobilityHelper uavMob;
+    uavMob.SetMobilityModel("ns3::WaypointMobilityModel");
+    uavMob.Install(uavEnbNodes);
+    double r = cfg.patrolRadius, leg = cfg.patrolPeriod / 4.0;
+    for (uint32_t i = 0; cfg.uavTrace.empty() && i < cfg.numUavs; ++i) {
+        Vector c = PatrolCenter(cfg, i);
+        Vector corners[4] = {Vector(c.x + r, c.y, c.z), Vector(c.x, c.y + r, c.z), Vector(c.x - r, c.y, c.z), Vector(c.x, c.y - r, c.z)};
+        Ptr<WaypointMobilityModel> wp = uavEnbNodes.Get(i)->GetObject<WaypointMobilityModel>();
+        for (uint32_t k = 0; k * leg <= cfg.simTime + leg; ++k) wp->AddWaypoint(Waypoint(Seconds(k * leg), corners[(k + i) % 4]));
+    }
+
+    // UE theo trace: chỉ cần WaypointMobilityModel, waypoint do ueTraceFeeder đẩy vào
+    if (!cfg.ueTrace.empty()) {
+        MobilityHelper traceMob;
+        traceMob.SetMobilityModel("ns3::WaypointMobilityModel");
+        traceMob.Install(globalUeNodes);
+        std::cout << "TOPOLOGY: " << cfg.numUavs << " UAVs (" << cols << "x" << rows << " grid), " << cfg.numUes
+                  << " UEs from trace " << cfg.ueTrace << std::endl;
+        return;
+    }
+
+    // UE: [0, nStatic) đứng yên, [nStatic, nStatic+nVeh) đi xe, còn lại đi bộ
+    uint32_t nStatic = std::min<uint32_t>(cfg.numUes, std::lround(cfg.numUes * cfg.staticFraction));
+    uint32_t nVeh = std::min<uint32_t>(cfg.numUes - nStatic, std::lround(cfg.numUes * cfg.vehicularFraction));
+    NodeContainer staticUes, vehUes, pedUes;
+    ueClasses.assign(cfg.numUes, UeClass::PEDESTRIAN);
+    for (uint32_t i = 0; i < cfg.numUes; ++i) {
+        if (i < nStatic) { staticUes.Add(globalUeNodes.Get(i)); ueClasses[i] = UeClass::STATIC; }
+        else if (i < nStatic + nVeh) { vehUes.Add(globalUeNodes.Get(i)); ueClasses[i] = UeClass::VEHICULAR; }
+        else pedUes.Add(globalUeNodes.Get(i));
+    }
+    std::ostringstream xs, ys;
+    xs << "ns3::UniformRandomVariable[Min=0|Max=" << width << "]";
+    ys << "ns3::UniformRandomVariable[Min=0|Max=" << height << "]";
+    Ptr<RandomRectanglePositionAllocator> area = CreateObject<RandomRectanglePositionAllocator>();
+    area->SetAttribute("X", StringValue(xs.str()));
+    area->SetAttribute("Y", StringValue(ys.str()));
+    area->SetAttribute("Z", DoubleValue(1.5));
+
+    MobilityHelper ueMob;
+    ueMob.SetPositionAllocator(area);
+    ueMob.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    ueMob.Install(staticUes);
+    ueMob.SetMobilityModel("ns3::RandomWaypointMobilityModel",
+                           "Speed", StringValue("ns3::UniformRandomVariable[Min=8.0|Max=15.0]"),
+                           "Pause", StringValue("ns3::ConstantRandomVariable[Constant=0.0]"),
+                           "PositionAllocator", PointerValue(area));
+    ueMob.Install(vehUes);
+    ueMob.SetMobilityModel("ns3::RandomWalk2dMobilityModel",
+                           "Bounds", RectangleValue(Rectangle(0, width, 0, height)),
+                           "Speed", StringValue("ns3::UniformRandomVariable[Min=1.0|Max=2.0]"),
+                           "Mode", StringValue("Time"));
+    ueMob.Install(pedUes);
+
+    std::cout << "TOPOLOGY: " << cfg.numUavs << " UAVs (" << cols << "x" << rows << " grid, "
+              << width << "x" << height << " m), " << cfg.numUes << " UEs (static " << staticUes.GetN()
+              << ", vehicular " << vehUes.GetN() << ", pedestrian " << pedUes.GetN() << ")" << std::endl;
+}
+
+// Dựng node + mobility; trace (nếu có) thay mobility của topology sinh tự động
+void BuildTopology(const ScenarioConfig& cfg, NodeContainer& uavEnbNodes) {
+    bool traced = !cfg.uavTrace.empty() || !cfg.ueTrace.empty();
+    NS_ABORT_MSG_IF(traced && cfg.numUavs == 0, "Mobility traces need a generated topology: set numUavs / numUes to the trace's node counts");
+    if (cfg.numUavs > 0) BuildGeneratedTopology(cfg, uavEnbNodes);
+    else BuildLegacyTopology(uavEnbNodes);
+    if (!cfg.uavTrace.empty()) uavTraceFeeder.Open(cfg.uavTrace, uavEnbNodes, cfg.uavAltitude, cfg.traceHorizon, cfg.simTime, "UAVs");
+    if (!cfg.ueTrace.empty()) ueTraceFeeder.Open(cfg.ueTrace, globalUeNodes, 1.5, cfg.traceHorizon, cfg.simTime, "UEs");
+}
+
+// KPI tổng hợp của một lần chạy, dùng cho sweep và benchmark
+struct RunKpis {
+    uint32_t handovers = 0;
+    uint32_t pingPongs = 0;
+    double mecLatencyMean = 0.0;   // s
+    double mecLatencyP95 = 0.0;    // s
+    double lossRate = 0.0;         // %
+    double migrationWaitMean = 0.0;// s, trung bình trên các task offload
+    double migratedMB = 0.0;       // tổng byte state đã gửi qua X2 (mỗi hop tính một lần)
+    uint32_t wastedPrecopies = 0;
+    double offloadRatio = 0.0;     // tỉ lệ task MEC được offload lên UAV
+    uint64_t events = 0;           // số event ns-3 đã thực thi
+    double setupSec = 0.0;         // wall time dựng topology
+    double runSec = 0.0;           // wall time Simulator::Run
+    double throughputMean = 0.0;   // Mb/s, trung bình các mẫu 100 ms của mọi UE
+    double ueEnergyMean = 0.0;     // J năng lượng UE mỗi task hoàn tất
+    double decisionNs = 0.0;       // ns trung bình cho một quyết định offload
+    uint32_t rlfs = 0;             // RLF + HO lỗi
+    uint32_t tooEarly = 0, tooLate = 0, wrongCell = 0;
+};
+
+double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+// kpi.csv: file process con ghi lại cho process cha (sweep, benchmark) đọc
+const char* kKpiHeader = "Handovers,PingPongs,MecLatencyMean,MecLatencyP95,LossRate,MigrationWaitMean,MigratedMB,"
+                         "WastedPrecopies,OffloadRatio,Events,SetupSec,RunSec,ThroughputMean,UeEnergyMean,DecisionNs,"
+                         "Rlfs,TooEarly,TooLate,WrongCell";
+
+bool WriteKpiFile(const std::string& path, const RunKpis& k) {
+    std::ofstream out(path);
+    out << kKpiHeader << "\n"
+        << k.handovers << "," << k.pingPongs << "," << k.mecLatencyMean << "," << k.mecLatencyP95 << ","
+        << k.lossRate << "," << k.migrationWaitMean << "," << k.migratedMB << "," << k.wastedPrecopies << ","
+        << k.offloadRatio << "," << k.events << "," << k.setupSec << "," << k.runSec << "," << k.throughputMean << ","
+        << k.ueEnergyMean << "," << k.decisionNs << "," << k.rlfs << "," << k.tooEarly << "," << k.tooLate << ","
+        << k.wrongCell << "\n";
+    out.close();
+    return (bool)out;
+}
+
+// Trả về false nếu file thiếu / hỏng; `line` giữ nguyên dòng giá trị để chép sang bảng tổng
+bool ReadKpiFile(const std::string& path, RunKpis& k, std::string& line) {
+    std::ifstream in(path);
+    std::string header, item;
+    if (!std::getline(in, header) || !std::getline(in, line)) return false;
+    std::vector<double> v;
+    std::stringstream ss(line);
+    while (std::getline(ss, item, ',')) v.push_back(std::stod(item));
+    if (v.size() < 19) return false;
+    k.handovers = v[0]; k.pingPongs = v[1]; k.mecLatencyMean = v[2]; k.mecLatencyP95 = v[3]; k.lossRate = v[4];
+    k.migrationWaitMean = v[5]; k.migratedMB = v[6]; k.wastedPrecopies = v[7];
+    k.offloadRatio = v[8]; k.events = v[9]; k.setupSec = v[10]; k.runSec = v[11]; k.throughputMean = v[12];
+    k.ueEnergyMean = v[13]; k.decisionNs = v[14];
+    k.rlfs = v[15]; k.tooEarly = v[16]; k.tooLate = v[17]; k.wrongCell = v[18];
+    return true;
+}
+
+const double kWarmupTime = 1.0;   // s, attach + khởi động LTE; app bắt đầu phát từ đây
+
+// Node, device, helper của một mạng đã dựng. Run thường dựng xong chạy luôn; warm start dựng và
+// warm-up một lần rồi fork mỗi run từ trạng thái này
+struct ScenarioNetwork {
+    NodeContainer uavEnbNodes;
+    // Chỉ có ở radio lte: node/device còn dùng cho app, trace, NetAnim và gán lại RNG stream
+    Ptr<LteHelper> lteHelper;
+    Ptr<PointToPointEpcHelper> epcHelper;
+    Ptr<Node> remoteHost, pgw, mme, mecHost;
+    NetDeviceContainer uavDevs, ueDevs;
+    Ipv4InterfaceContainer ueIp;
+    bool abstract = false;
+};
+
+const uint32_t kRlcDefaultBufferBytes = 10 * 1024;   // LteRlcUm::MaxTxBufferSize mặc định của ns-3
+
+// Input/output task MEC được gửi cả burst một lúc; burst lớn hơn buffer RLC thì phần đuôi bị drop và
+// task không bao giờ xong. Giữ mặc định ns-3 (baseline downlink không đổi), chỉ nâng đủ cho 2 burst
+// chồng nhau (chunk + header MEC/UDP/IP) khi mặc định không vừa
+uint32_t RlcBufferBytes(const ScenarioConfig& cfg) {
+    if (cfg.rlcBufferBytes > 0) return cfg.rlcBufferBytes;
+    auto burst = [](uint32_t bytes) { return (bytes + kMecChunkBytes - 1) / kMecChunkBytes * (kMecChunkBytes + 8 + 28); };
+    return std::max(kRlcDefaultBufferBytes, 2 * std::max(burst(cfg.mec.inputBytes), burst(cfg.mec.outputBytes)));
+}
+
+// Tham số một run đọc qua global: MEC, traffic, chính sách offload, RNG
+void ApplyRunConfig(const ScenarioConfig& cfg) {
+    mecCfg = cfg.mec;
+    trafficCfg = cfg.traffic;
+    ConfigureOffloadPolicy(mecCfg);
+    SelfProfiler::Get().Enable(cfg.profile);
+    RngSeedManager::SetSeed(cfg.seed); RngSeedManager::SetRun(cfg.run);
+}
+
+// Open Trace Files (và writer thread: thread không sống qua fork nên mở ở process chạy run)
+void OpenTraceFiles(const ScenarioConfig& cfg) {
+    TraceFormat fmt = (cfg.traceFormat == "bin") ? TraceFormat::BINARY : TraceFormat::CSV;
+    uint32_t traceBatch = cfg.traceBatch;
+    TraceWriter::Get().Start(cfg.traceAsync, 64);
+    // Các file lấy mẫu định kỳ chỉ mở khi --rawTraces; percentile đã có trong KPI summary
+    if (cfg.rawTraces) {
+        rsrpFile.Open("scenario1_final_rsrp.csv", fmt, traceBatch);
+        sinrFile.Open("scenario1_final_sinr.csv", fmt, traceBatch);
+        throughputFile.Open("scenario1_final_throughput.csv", fmt, traceBatch);
+        positionFile.Open("scenario1_final_ue_position.csv", fmt, traceBatch);
+        uavPositionFile.Open("scenario1_final_uav_position.csv", fmt, traceBatch);
+    }
+    handoverFile.Open("scenario1_final_handover.csv", fmt, traceBatch);
+    cellIdFile.Open("scenario1_final_cellid.csv", fmt, traceBatch);
+    handoverQualityFile.Open("scenario1_final_handover_quality.csv", fmt, traceBatch);
+    mecOffloadFile.Open("scenario1_final_mec_offload.csv", fmt, traceBatch);
+    offloadDecisionFile.Open("scenario1_final_offload_decisions.csv", fmt, traceBatch);
+    hoTraceFile.Open("handover_trace.csv", fmt, traceBatch);
+    flowStatsFile.Open("scenario1_final_flow_stats.csv", fmt, traceBatch);
+    mecTaskFile.Open("scenario1_final_mec_tasks.csv", fmt, traceBatch);
+    migrationFile.Open("scenario1_final_migrations.csv", fmt, traceBatch);
+    hoInterruptionFile.Open("scenario1_final_ho_interruption.csv", fmt, traceBatch);
+    handoverIssueFile.Open("scenario1_final_handover_issues.csv", fmt, traceBatch);
+    if (cfg.placement != "off") placementFile.Open("scenario1_final_placement.csv", fmt, traceBatch);
+    // Capacity theo cell chỉ đo được với traffic thật của radio lte
+    if (cfg.radio == "lte") cellCapacityFile.Open("scenario1_final_cell_capacity.csv", fmt, traceBatch);
+}
+
+// Topology, mạng LTE/EPC, X2, MEC host, sink và hook trace. Chưa app nào phát: traffic, MEC,
+// sampler và output do RunNetwork gắn, nên mọi thứ ở đây dùng chung được cho một batch warm start
+void BuildNetwork(const ScenarioConfig& cfg, ScenarioNetwork& net) {
+    bool generated = cfg.numUavs > 0;
+    NodeContainer& uavEnbNodes = net.uavEnbNodes;
+    Ptr<PointToPointEpcHelper>& epcHelper = net.epcHelper;
+    Ptr<Node>& remoteHost = net.remoteHost;
+    Ptr<Node>& pgw = net.pgw;
+    Ptr<Node>& mme = net.mme;
+    Ptr<Node>& mecHost = net.mecHost;
+    NetDeviceContainer& ueDevs = net.ueDevs;
+    Ipv4InterfaceContainer& ueIp = net.ueIp;
+    net.abstract = cfg.radio == "abstract";
+    bool abstract = net.abstract;
+    NS_ABORT_MSG_IF(!abstract && cfg.radio != "lte", "Unknown radio engine " << cfg.radio);
+    if (abstract) {
+        BuildTopology(cfg, uavEnbNodes);
+        // IMSI theo thứ tự UE, giống LteHelper::InstallUeDevice
+        ueState.Build(globalUeNodes.GetN());
+        for (uint32_t i = 0; i < globalUeNodes.GetN(); ++i) ueState.BindImsi(i, i + 1);
+    } else {
+        // LTE Configuration
+        // Nhiều UE trên một eNB: tăng chu kỳ SRS để đủ slot (mặc định chỉ đủ cho vài chục UE)
+        if (generated) Config::SetDefault("ns3::LteEnbRrc::SrsPeriodicity", UintegerValue(320));
+        Config::SetDefault("ns3::LteRlcUm::MaxTxBufferSize", UintegerValue(RlcBufferBytes(cfg)));
+        Ptr<LteHelper> lteHelper = net.lteHelper = CreateObject<LteHelper>();
+        epcHelper = CreateObject<PointToPointEpcHelper>();
+        lteHelper->SetEpcHelper(epcHelper);
+        // Link X2 giữa các UAV cũng là đường chuyển state container khi migration. Mặc định trùng
+        // mặc định ns-3 nên tín hiệu X2 của handover giữ nguyên timing khi không chỉnh --x2Rate/--x2Delay
+        epcHelper->SetAttribute("X2LinkDataRate", DataRateValue(DataRate(std::to_string((uint64_t)(mecCfg.x2RateMbps * 1e6)) + "bps")));
+        epcHelper->SetAttribute("X2LinkDelay", TimeValue(Seconds(mecCfg.x2DelayMs / 1000.0)));
+        lteHelper->SetAttribute("UseIdealRrc", BooleanValue(false));
     
-    // Building Environment
-    BuildingsHelper::Install(uavEnbNodes); BuildingsHelper::Install(globalUeNodes);
-    Ptr<GridBuildingAllocator> grid = CreateObject<GridBuildingAllocator>();
-    grid->SetAttribute("GridWidth", UintegerValue(3)); grid->SetAttribute("LengthX", DoubleValue(20)); grid->Create(9);
-    
-    // Install LTE Devices
-    NetDeviceContainer uavDevs = lteHelper->InstallEnbDevice(uavEnbNodes);
-    NetDeviceContainer ueDevs = lteHelper->InstallUeDevice(globalUeNodes);
-    
-    // Configure Spectrum & Power
-    for(uint32_t i=0; i<uavDevs.GetN(); ++i) {
-        uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->SetAttribute("DlEarfcn", UintegerValue(100));
-        uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->SetAttribute("UlEarfcn", UintegerValue(18100));
-        uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->GetPhy()->SetAttribute("TxPower", DoubleValue(43.0));
-    }
-    for(uint32_t i=0; i<ueDevs.GetN(); ++i) ueDevs.Get(i)->GetObject<LteUeNetDevice>()->SetAttribute("DlEarfcn", UintegerValue(100));
-    
-    // IP Stack & Routing
-    internet.Install(globalUeNodes);
-    Ipv4InterfaceContainer ueIp = epcHelper->AssignUeIpv4Address(NetDeviceContainer(ueDevs));
-    for(uint32_t i=0; i<globalUeNodes.GetN(); ++i) ipv4RoutingHelper.GetStaticRouting(globalUeNodes.Get(i)->GetObject<Ipv4>())->SetDefaultRoute(epcHelper->GetUeDefaultGatewayAddress(), 1);
-    
-    // Attach UEs to initial UAVs
-    lteHelper->Attach(ueDevs.Get(0), uavDevs.Get(0));
-    lteHelper->Attach(ueDevs.Get(1), uavDevs.Get(0));
-    lteHelper->Attach(ueDevs.Get(2), uavDevs.Get(2));
-    lteHelper->AddX2Interface(uavEnbNodes); 
-    
-    // Apps (UDP Traffic)
-    uint16_t port = 1234;
-    ApplicationContainer apps;
-    
-    for(uint32_t i=0; i<globalUeNodes.GetN(); ++i) {
-        // Cài Sink (Nhận tin) trên UE - Dùng UDP
-        PacketSinkHelper sink("ns3::UdpSocketFactory", InetSocketAddress(Ipv4Address::GetAny(), port));
-        apps.Add(sink.Install(globalUeNodes.Get(i)));
-        
-        // 2. Cài Client (Gửi tin) trên Remote Host bắn về IP của UE
-        UdpClientHelper client(ueIp.GetAddress(i), port);
-        
-        // Cấu hình: Gửi liên tục, mỗi gói 1472 bytes, cách nhau 4ms (~3 Mbps)
-        client.SetAttribute("MaxPackets", UintegerValue(100000000));
-        client.SetAttribute("Interval", TimeValue(MilliSeconds(4.0))); 
-        client.SetAttribute("PacketSize", UintegerValue(1472));
-        
-        apps.Add(client.Install(remoteHost));
-        
-        // Khởi tạo lại các map theo dõi
-        totalRxBytes[i+1] = 0; 
-        lastThroughput[i+1] = 0.0;
-        ueCurrentCellMap[i+1] = 0; 
-        uePreviousMecCellMap[i+1] = 0;
+        // --- TUNING HANDOVER SENSITIVITY ---
+        lteHelper->SetHandoverAlgorithmType("ns3::A3RsrpHandoverAlgorithm");
+        lteHelper->SetHandoverAlgorithmAttribute("Hysteresis", DoubleValue(cfg.hysteresis)); 
+        lteHelper->SetHandoverAlgorithmAttribute("TimeToTrigger", TimeValue(MilliSeconds(cfg.timeToTriggerMs))); 
+    
+        //lteHelper->SetAttribute("PathlossModel", StringValue("ns3::FriisPropagationLossModel"));
+        if (cfg.pathlossCache > 0) {
+            // LogDistance bọc trong cache: cùng tham số, tính lại khi node dịch chuyển quá tolerance
+            Ptr<LogDistancePropagationLossModel> logDistance = CreateObject<LogDistancePropagationLossModel>();
+            logDistance->SetAttribute("Exponent", DoubleValue(cfg.pathlossExponent));
+            logDistance->SetAttribute("ReferenceLoss", DoubleValue(kReferenceLossDb));
+            lteHelper->SetAttribute("PathlossModel", StringValue("CachedPropagationLossModel"));
+            lteHelper->SetPathlossModelAttribute("Inner", PointerValue(logDistance));
+            lteHelper->SetPathlossModelAttribute("Tolerance", DoubleValue(cfg.pathlossCache));
+        } else {
+            lteHelper->SetAttribute("PathlossModel", StringValue("ns3::LogDistancePropagationLossModel"));
+    
+            // Cấu hình môi trường truyền sóng (Exponent = 3.0 tương đương đô thị)
+            lteHelper->SetPathlossModelAttribute("Exponent", DoubleValue(cfg.pathlossExponent)); 
+            lteHelper->SetPathlossModelAttribute("ReferenceLoss", DoubleValue(kReferenceLossDb)); // Chuẩn LTE 2GHz
+        }
+    
+        // Network Setup
+        pgw = epcHelper->GetPgwNode();
+        NodeContainer remoteHostContainer; remoteHostContainer.Create(1);
+        remoteHost = remoteHostContainer.Get(0);
+        InternetStackHelper internet; internet.Install(remoteHostContainer);
+        PointToPointHelper p2ph;
+        p2ph.SetDeviceAttribute("DataRate", DataRateValue(DataRate("100Gb/s")));
+        p2ph.SetChannelAttribute("Delay", TimeValue(MilliSeconds(10)));
+        NetDeviceContainer internetDevices = p2ph.Install(pgw, remoteHost);
+        Ipv4AddressHelper ipv4h; ipv4h.SetBase("1.0.0.0", "255.0.0.0");
+        remoteHostAddr = ipv4h.Assign(internetDevices).GetAddress(1);
+        Ipv4StaticRoutingHelper ipv4RoutingHelper;
+        ipv4RoutingHelper.GetStaticRouting(remoteHost->GetObject<Ipv4>())->AddNetworkRouteTo(Ipv4Address("7.0.0.0"), Ipv4Mask("255.0.0.0"), 1);
+    
+        MobilityHelper coreMobility;
+        Ptr<ListPositionAllocator> corePos = CreateObject<ListPositionAllocator>();
+    
+        // 1. Đặt Remote Host (Server) ở góc trên bên trái
+        corePos->Add(Vector(10, 250, 0)); 
+    
+        // 2. Đặt PGW (Gateway) thấp hơn Server một chút
+        corePos->Add(Vector(10, 200, 0));
+    
+        // 3. SGW (Serving Gateway) - do EPC Helper tự tạo, là Node số 1
+        corePos->Add(Vector(30, 180, 0));
+    
+        // 4. MME (Quản lý di động) -  do EPC Helper tự tạo, là Node số 2
+        corePos->Add(Vector(10, 160, 0));
+
+        coreMobility.SetPositionAllocator(corePos);
+        coreMobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    
+        // Cài đặt vị trí cho Remote Host 
+        coreMobility.Install(remoteHostContainer);
+    
+        // Cài đặt vị trí cho PGW
+        NodeContainer pgwContainer;
+        pgwContainer.Add(pgw);
+        coreMobility.Install(pgwContainer);
+        Ptr<Node> sgw = epcHelper->GetSgwNode();
+        NodeContainer sgwContainer;
+        sgwContainer.Add(sgw);
+        coreMobility.Install(sgwContainer);
+    
+        // MME là Node có ID = 2 
+        mme = NodeList::GetNode(2); 
+        NodeContainer mmeContainer;
+        mmeContainer.Add(mme);
+        // lấy vị trí thứ 4 trong ListPositionAllocator (Vector 10, 160, 0)
+        coreMobility.Install(mmeContainer);
+    
+        // Nodes & Mobility
+        BuildTopology(cfg, uavEnbNodes);
+    
+        // Building Environment
+        BuildingsHelper::Install(uavEnbNodes); BuildingsHelper::Install(globalUeNodes);
+        Ptr<GridBuildingAllocator> grid = CreateObject<GridBuildingAllocator>();
+        grid->SetAttribute("GridWidth", UintegerValue(3)); grid->SetAttribute("LengthX", DoubleValue(20)); grid->Create(9);
+    
+        // Install LTE Devices
+        NetDeviceContainer& uavDevs = net.uavDevs = lteHelper->InstallEnbDevice(uavEnbNodes);
+        ueDevs = lteHelper->InstallUeDevice(globalUeNodes);
+    
+        // Configure Spectrum & Power
+        for(uint32_t i=0; i<uavDevs.GetN(); ++i) {
+            uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->SetAttribute("DlEarfcn", UintegerValue(100));
+            uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->SetAttribute("UlEarfcn", UintegerValue(18100));
+            uavDevs.Get(i)->GetObject<LteEnbNetDevice>()->GetPhy()->SetAttribute("TxPower", DoubleValue(cfg.txPower));
+        }
+        for(uint32_t i=0; i<ueDevs.GetN(); ++i) ueDevs.Get(i)->GetObject<LteUeNetDevice>()->SetAttribute("DlEarfcn", UintegerValue(100));
+    
+        // Bảng state UE: một slot cho mỗi UE, IMSI lấy từ device
+        ueState.Build(globalUeNodes.GetN());
+        for(uint32_t i=0; i<ueDevs.GetN(); ++i) ueState.BindImsi(i, ueDevs.Get(i)->GetObject<LteUeNetDevice>()->GetImsi());
+    
+        // IP Stack & Routing
+        internet.Install(globalUeNodes);
+        ueIp = epcHelper->AssignUeIpv4Address(NetDeviceContainer(ueDevs));
+        for(uint32_t i=0; i<globalUeNodes.GetN(); ++i) ipv4RoutingHelper.GetStaticRouting(globalUeNodes.Get(i)->GetObject<Ipv4>())->SetDefaultRoute(epcHelper->GetUeDefaultGatewayAddress(), 1);
+    
+        // Attach UEs to initial UAVs
+        if (generated) {
+            lteHelper->AttachToClosestEnb(ueDevs, uavDevs);
+            // X2 chỉ giữa các UAV kề nhau trên lưới (kể cả chéo) thay vì full mesh O(N^2);
+            // UAV bay theo trace không có vị trí lưới nên nối full mesh
+            for (uint32_t i = 0; i < uavEnbNodes.GetN(); ++i)
+                for (uint32_t j = i + 1; j < uavEnbNodes.GetN(); ++j)
+                    if (!cfg.uavTrace.empty() || CalculateDistance(PatrolCenter(cfg, i), PatrolCenter(cfg, j)) < 1.5 * cfg.cellSpacing)
+                        lteHelper->AddX2Interface(uavEnbNodes.Get(i), uavEnbNodes.Get(j));
+        } else {
+            lteHelper->Attach(ueDevs.Get(0), uavDevs.Get(0));
+            lteHelper->Attach(ueDevs.Get(1), uavDevs.Get(0));
+            lteHelper->Attach(ueDevs.Get(2), uavDevs.Get(2));
+            lteHelper->AddX2Interface(uavEnbNodes); 
+        }
+    
+        // MEC: mecHost nối PGW (edge, 1 ms), một MEC server cho mỗi UAV eNB
+        NodeContainer mecHostContainer; mecHostContainer.Create(1);
+        mecHost = mecHostContainer.Get(0);
+        internet.Install(mecHostContainer);
+        PointToPointHelper mecLink;
+        mecLink.SetDeviceAttribute("DataRate", DataRateValue(DataRate("100Gb/s")));
+        mecLink.SetChannelAttribute("Delay", TimeValue(MilliSeconds(1)));
+        Ipv4AddressHelper mecIp; mecIp.SetBase("2.0.0.0", "255.0.0.0");
+        mecHostAddress = mecIp.Assign(mecLink.Install(pgw, mecHost)).GetAddress(1);
+        ipv4RoutingHelper.GetStaticRouting(mecHost->GetObject<Ipv4>())->AddNetworkRouteTo(Ipv4Address("7.0.0.0"), Ipv4Mask("255.0.0.0"), 1);
+        Ptr<ListPositionAllocator> mecPos = CreateObject<ListPositionAllocator>(); mecPos->Add(Vector(30, 250, 0));
+        coreMobility.SetPositionAllocator(mecPos);
+        coreMobility.Install(mecHostContainer);
     }
-    // Start trễ 1 giây để mạng LTE kịp khởi động 
-    apps.Start(Seconds(1.0));
     
-    // MEC Simulation Loop
-    for(double t=2.0; t<simTime; t+=2.0) Simulator::Schedule(Seconds(t), &GenerateMecTask, 2); 
+    // State nhận event ngay từ attach (ConnectionEstablished) nên dựng cùng mạng
+    kpiStats.Configure(globalUeNodes.GetN(), uavEnbNodes.GetN());
+    hoAnalytics.Configure(uavEnbNodes.GetN());
+    migration.Install(uavEnbNodes, globalUeNodes.GetN(), mecCfg);
+    if (!abstract) {
+        mecHostSocket = Socket::CreateSocket(mecHost, UdpSocketFactory::GetTypeId());
+        mecHostSocket->Bind(InetSocketAddress(Ipv4Address::GetAny(), kMecServerPort));
+        mecHostSocket->SetRecvCallback(MakeCallback(&MecHostReceive));
+        for (uint32_t i = 0; i < globalUeNodes.GetN(); ++i) {
+            Ptr<Socket> sock = Socket::CreateSocket(globalUeNodes.Get(i), UdpSocketFactory::GetTypeId());
+            sock->Bind(InetSocketAddress(Ipv4Address::GetAny(), kMecClientPort));
+            sock->SetRecvCallback(MakeCallback(&UeMecReceive));
+            ueMecSockets.push_back(sock);
+            ueAddresses.push_back(ueIp.GetAddress(i));
+        }
+    
+        // Apps (UDP Traffic): sink dựng cùng mạng, nguồn phát gắn trong RunNetwork
+        ApplicationContainer sinkApps;
+        for(uint32_t i=0; i<globalUeNodes.GetN(); ++i) {
+            // Cài Sink (Nhận tin) trên UE - Dùng UDP
+            PacketSinkHelper sink("ns3::UdpSocketFactory", InetSocketAddress(Ipv4Address::GetAny(), kDlPort));
+            ApplicationContainer sinkApp = sink.Install(globalUeNodes.Get(i));
+            ueSinks.push_back(sinkApp.Get(0)->GetObject<PacketSink>());
+            ueSinks.back()->TraceConnectWithoutContext("Rx", MakeBoundCallback(&UePacketRx, &ueState[i]));
+            sinkApps.Add(sinkApp);
+        }
+        // Start trễ 1 giây để mạng LTE kịp khởi động 
+        sinkApps.Start(Seconds(kWarmupTime));
+    
+        // Traces
+        Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/HandoverStart", MakeCallback(&NotifyHandoverStartUe));
+        Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/HandoverEndOk", MakeCallback(&NotifyHandoverEndOkUe));
+        Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/HandoverEndError", MakeCallback(&NotifyHandoverEndErrorUe));
+        Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/RadioLinkFailure", MakeCallback(&NotifyRadioLinkFailure));
+        Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/ConnectionEstablished", MakeCallback(&NotifyConnectionEstablished));
+        Config::Connect("/NodeList/*/DeviceList/*/LteEnbRrc/RecvMeasurementReport", MakeCallback(&RecvMeasurementReportCallback));
+        for(uint32_t i=0; i<ueDevs.GetN(); ++i) {
+            ueDevs.Get(i)->GetObject<LteUeNetDevice>()->GetPhy()->TraceConnectWithoutContext("ReportCurrentCellRsrpSinr", MakeBoundCallback(&ReportRsrp, ueDevs.Get(i)->GetObject<LteUeNetDevice>()->GetImsi()));
+        }
+    }
+}
+
+// Gán lại stream RNG của các model dựng trong BuildNetwork sang run hiện tại (substream của
+// RngStream), để các worker fork từ cùng một mạng đã warm-up đi theo đường ngẫu nhiên riêng
+void ReseedNetwork(const ScenarioNetwork& net, uint32_t run) {
+    RngSeedManager::SetRun(run);
+    int64_t stream = 0;
+    stream += net.lteHelper->AssignStreams(net.uavDevs, stream);
+    stream += net.lteHelper->AssignStreams(net.ueDevs, stream);
+    MobilityHelper mobility;
+    stream += mobility.AssignStreams(net.uavEnbNodes, stream);
+    stream += mobility.AssignStreams(globalUeNodes, stream);
+    InternetStackHelper internet;
+    internet.AssignStreams(globalUeNodes, stream);
+}
+
+// Tham số của run (MEC, traffic, phân tích HO, placement), sampler và output rồi chạy tới simTime.
+// Gọi ngay sau BuildNetwork ở t = 0, hoặc trong worker warm start ở t = kWarmupTime
+RunKpis RunNetwork(const ScenarioConfig& cfg, ScenarioNetwork& net, std::chrono::steady_clock::time_point wallStart) {
+    double simTime = cfg.simTime;
+    bool generated = cfg.numUavs > 0;
+    bool abstract = net.abstract;
+    NodeContainer& uavEnbNodes = net.uavEnbNodes;
+    TraceFormat fmt = (cfg.traceFormat == "bin") ? TraceFormat::BINARY : TraceFormat::CSV;
+    double now = Simulator::Now().GetSeconds();
+
+    QueueDiscipline discipline = QueueDiscipline::FIFO;
+    if (mecCfg.discipline == "edf") discipline = QueueDiscipline::EDF;
+    else if (mecCfg.discipline == "priority") discipline = QueueDiscipline::PRIORITY;
+    else NS_ABORT_MSG_IF(mecCfg.discipline != "fifo", "Unknown mecDiscipline " << mecCfg.discipline);
+    NS_ABORT_MSG_IF(mecCfg.timeout <= 0.0, "mecTimeout must be > 0");
+    mecServers.resize(uavEnbNodes.GetN());
+    for (uint32_t i = 0; i < uavEnbNodes.GetN(); ++i) mecServers[i].Configure(i + 1, mecCfg.cores, mecCfg.clockMHz, discipline);
+    hoAnalytics.SetWindows(cfg.pingPongWindow, cfg.hoFailureWindow);
+    migration.Reconfigure(mecCfg);
+    if (abstract) {
+        // Kịch bản gốc: UE1, UE2 gắn UAV1 và UE3 gắn UAV3 như lteHelper->Attach; sinh tự động: UAV gần nhất
+        std::vector<uint16_t> initialCell;
+        if (!generated) initialCell = {1, 1, 3};
+        if (trafficCfg.profile != "cbr" || !trafficCfg.staticProfile.empty() || !trafficCfg.vehicularProfile.empty() ||
+            !trafficCfg.pedestrianProfile.empty() || trafficCfg.ulRateMbps > 0)
+            std::cout << "TRAFFIC: radio=abstract models cbr downlink only, traffic profiles ignored" << std::endl;
+        abstractRadio.Install(uavEnbNodes, globalUeNodes, initialCell, cfg.txPower, cfg.pathlossExponent,
+                              cfg.hysteresis, cfg.timeToTriggerMs, cfg.radioTable, cfg.pathlossCache, simTime);
+    } else {
+        Ptr<Node> remoteHost = net.remoteHost;
+        ApplicationContainer apps;
+        for(uint32_t i=0; i<globalUeNodes.GetN(); ++i) {
+            // 2. Cài nguồn traffic (Gửi tin) trên Remote Host bắn về IP của UE, profile theo lớp UE
+            Ptr<TrafficSource> source = CreateObject<TrafficSource>();
+            source->Setup(TrafficKindOf(i), trafficCfg.rateMbps, InetSocketAddress(net.ueIp.GetAddress(i), kDlPort), &ueState[i]);
+            remoteHost->AddApplication(source);
+            dlSources.push_back(source);
+            apps.Add(source);
+
+            // 3. Uplink cbr UE -> Remote Host (tuỳ chọn)
+            if (trafficCfg.ulRateMbps > 0) {
+                Ptr<TrafficSource> ul = CreateObject<TrafficSource>();
+                ul->Setup(TrafficKind::CBR, trafficCfg.ulRateMbps, InetSocketAddress(remoteHostAddr, kUlPort), nullptr);
+                globalUeNodes.Get(i)->AddApplication(ul);
+                apps.Add(ul);
+            }
+        }
+        if (trafficCfg.ulRateMbps > 0) {
+            PacketSinkHelper ulSink("ns3::UdpSocketFactory", InetSocketAddress(Ipv4Address::GetAny(), kUlPort));
+            ulSinkApp = ulSink.Install(remoteHost).Get(0)->GetObject<PacketSink>();
+            apps.Add(ulSinkApp);
+        }
+        cellCapacity.Install(globalUeNodes.GetN(), uavEnbNodes.GetN(), simTime);
+        // Phát từ kWarmupTime (thời gian tương đối tính từ lúc gắn app)
+        apps.Start(Seconds(std::max(0.0, kWarmupTime - now)));
+        if (!cfg.radioTableOut.empty()) rateCalibration.Open(cfg.radioTableOut);
+    }
+    if (cfg.placement == "greedy") {
+        NS_ABORT_MSG_IF(!cfg.uavTrace.empty(), "placement=greedy and uavTrace both drive the UAVs");
+        uavPlacement.Install(uavEnbNodes, globalUeNodes, cfg.txPower, cfg.pathlossExponent, cfg.placementInterval,
+                             cfg.uavSpeed, cfg.uavMinAltitude, cfg.uavMaxAltitude, cfg.placementJobs, simTime);
+    } else {
+        NS_ABORT_MSG_IF(cfg.placement != "off", "Unknown placement mode " << cfg.placement);
+    }
     
-    // Traces
-    Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/HandoverStart", MakeCallback(&NotifyHandoverStartUe));
-    Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/HandoverEndOk", MakeCallback(&NotifyHandoverEndOkUe));
-    Config::Connect("/NodeList/*/DeviceList/*/LteUeRrc/ConnectionEstablished", MakeCallback(&NotifyConnectionEstablished));
-    Config::Connect("/NodeList/*/DeviceList/*/LteEnbRrc/RecvMeasurementReport", MakeCallback(&RecvMeasurementReportCallback));
-    for(uint32_t i=0; i<ueDevs.GetN(); ++i) {
-        ueDevs.Get(i)->GetObject<LteUeNetDevice>()->GetPhy()->TraceConnectWithoutContext("ReportCurrentCellRsrpSinr", MakeBoundCallback(&ReportRsrp, ueDevs.Get(i)->GetObject<LteUeNetDevice>()->GetImsi()));
+    // MEC Simulation Loop
+    PeriodicSampler& sampler = PeriodicSampler::Get();
+    if (!cfg.taskTrace.empty()) taskTrace.Open(cfg.taskTrace, globalUeNodes.GetN(), simTime);
+    // Mọi UE đều sinh task
+    for (uint32_t k = 0; cfg.taskTrace.empty() && k < ueState.Size(); ++k) {
+        UeState* ue = &ueState[k];
+        if (mecCfg.arrival == "poisson") {
+            Ptr<ExponentialRandomVariable> gap = CreateObject<ExponentialRandomVariable>();
+            gap->SetAttribute("Mean", DoubleValue(mecCfg.interval));
+            Simulator::Schedule(Seconds(std::max(0.0, kWarmupTime - now) + gap->GetValue()), &PoissonMecArrival, ue, gap, simTime);
+        } else {
+            sampler.Register(Seconds(mecCfg.interval), Seconds(2.0), Seconds(simTime), [ue] { GenerateMecTask(*ue); });
+        }
     }
     
     // Monitoring Schedules
-    for(double t=1.0; t<simTime; t+=1.0) Simulator::Schedule(Seconds(t), &LogPositions, globalUeNodes, uavEnbNodes);
-    for(double t=1.0; t<simTime; t+=0.1) {
-        // apps.Get(0) -> Sink của UE 1
-        Simulator::Schedule(Seconds(t), &CalculateThroughput, apps.Get(0)->GetObject<PacketSink>(), 1, 0.1);
-        
-        // apps.Get(2) -> Sink của UE 2
-        Simulator::Schedule(Seconds(t), &CalculateThroughput, apps.Get(2)->GetObject<PacketSink>(), 2, 0.1);
-        
-        // apps.Get(4) -> Sink của UE 3
-        Simulator::Schedule(Seconds(t), &CalculateThroughput, apps.Get(4)->GetObject<PacketSink>(), 3, 0.1);
+    for (uint32_t i = 0; cfg.rawTraces && i < globalUeNodes.GetN(); ++i) {
+        Ptr<MobilityModel> m = globalUeNodes.Get(i)->GetObject<MobilityModel>();
+        sampler.Register(Seconds(1.0), Seconds(1.0), Seconds(simTime), [m, i] { LogPosition(m, false, i+1); });
+    }
+    for (uint32_t i = 0; cfg.rawTraces && i < uavEnbNodes.GetN(); ++i) {
+        Ptr<MobilityModel> m = uavEnbNodes.Get(i)->GetObject<MobilityModel>();
+        sampler.Register(Seconds(1.0), Seconds(1.0), Seconds(simTime), [m, i] { LogPosition(m, true, i+1); });
+    }
+    for (uint32_t i = 0; i < ueSinks.size(); ++i) {
+        Ptr<PacketSink> sink = ueSinks[i];
+        UeState* ue = &ueState[i];
+        sampler.Register(MilliSeconds(100), Seconds(1.0), Seconds(simTime), [sink, ue] { CalculateThroughput(sink, ue, 0.1); });
+    }
+    if (cfg.kpiInterval > 0) {
+        kpiStats.OpenIntervals("scenario1_final_kpi_intervals.csv");
+        sampler.Register(Seconds(cfg.kpiInterval), Seconds(cfg.kpiInterval), Seconds(simTime),
+                         [] { kpiStats.WriteInterval(Simulator::Now().GetSeconds()); });
     }
     
-    // NetAnim
-    pAnim = new AnimationInterface("scenario1_final.xml");
-    pAnim->EnablePacketMetadata(false); 
-    pAnim->SetMaxPktsPerTraceFile(999999999999ULL);
+    // Animation: off | positions (keyframe gọn, không hook theo gói) | full (NetAnim như cũ)
+    std::string animation = cfg.animation;
+    if (abstract && animation == "full") {
+        std::cout << "Abstract radio has no packets or core nodes for NetAnim: using --animation=positions" << std::endl;
+        animation = "positions";
+    }
+    if (animation == "positions") {
+        animRecorder.Open("scenario1_final_anim.csv", fmt == TraceFormat::BINARY, cfg.animGzip, cfg.animMinMove);
+        for (uint32_t i = 0; i < uavEnbNodes.GetN(); ++i) animRecorder.AddNode(uavEnbNodes.Get(i)->GetObject<MobilityModel>(), true, i + 1);
+        for (uint32_t i = 0; i < globalUeNodes.GetN(); ++i) animRecorder.AddNode(globalUeNodes.Get(i)->GetObject<MobilityModel>(), false, i + 1);
+        sampler.Register(Seconds(cfg.animInterval), Seconds(0.0), Seconds(simTime), [] { animRecorder.Sample(); });
+    } else if (animation == "full") {
+        pAnim = new AnimationInterface("scenario1_final.xml");
+        pAnim->EnablePacketMetadata(false); 
+        pAnim->SetMaxPktsPerTraceFile(999999999999ULL);
     
-    pAnim->UpdateNodeDescription(uavEnbNodes.Get(0), "UAV-1 (Cell 1)"); pAnim->UpdateNodeColor(uavEnbNodes.Get(0), 255, 0, 0);
-    pAnim->UpdateNodeDescription(uavEnbNodes.Get(1), "UAV-2 (Cell 2)"); pAnim->UpdateNodeColor(uavEnbNodes.Get(1), 0, 255, 0);
-    pAnim->UpdateNodeDescription(uavEnbNodes.Get(2), "UAV-3 (Cell 3)"); pAnim->UpdateNodeColor(uavEnbNodes.Get(2), 128, 0, 128);
+        for (uint32_t i = 0; i < uavEnbNodes.GetN(); ++i) {
+            uint8_t r, g, b; CellColor(i + 1, r, g, b);
+            pAnim->UpdateNodeDescription(uavEnbNodes.Get(i), "UAV-" + std::to_string(i+1) + " (Cell " + std::to_string(i+1) + ")");
+            pAnim->UpdateNodeColor(uavEnbNodes.Get(i), r, g, b);
+        }
     
-    // Remote Host (Server)
-    pAnim->UpdateNodeDescription(remoteHost, "SERVER (Remote Host)");
-    pAnim->UpdateNodeColor(remoteHost, 0, 0, 255); // Màu Xanh Dương Đậm
-    pAnim->UpdateNodeSize(remoteHost, 2.0, 2.0); 
+        // Remote Host (Server)
+        pAnim->UpdateNodeDescription(net.remoteHost, "SERVER (Remote Host)");
+        pAnim->UpdateNodeColor(net.remoteHost, 0, 0, 255); // Màu Xanh Dương Đậm
+        pAnim->UpdateNodeSize(net.remoteHost, 2.0, 2.0); 
 
-    // PGW
-    pAnim->UpdateNodeDescription(pgw, "PGW (Gateway)");
-    pAnim->UpdateNodeColor(pgw, 100, 100, 100); // Màu Xám
+        // PGW
+        pAnim->UpdateNodeDescription(net.pgw, "PGW (Gateway)");
+        pAnim->UpdateNodeColor(net.pgw, 100, 100, 100); // Màu Xám
     
-    // SGW 
-    Ptr<Node> sgwNode = epcHelper->GetSgwNode();
-    pAnim->UpdateNodeDescription(sgwNode, "SGW");
-    pAnim->UpdateNodeColor(sgwNode, 150, 150, 150); // Xám nhạt
+        // SGW 
+        Ptr<Node> sgwNode = net.epcHelper->GetSgwNode();
+        pAnim->UpdateNodeDescription(sgwNode, "SGW");
+        pAnim->UpdateNodeColor(sgwNode, 150, 150, 150); // Xám nhạt
     
-    pAnim->UpdateNodeDescription(mme, "MME (Control)");
-    pAnim->UpdateNodeColor(mme, 200, 200, 200); // Màu xám nhạt hơn
+        pAnim->UpdateNodeDescription(net.mme, "MME (Control)");
+        pAnim->UpdateNodeColor(net.mme, 200, 200, 200); // Màu xám nhạt hơn
+    } else {
+        NS_ABORT_MSG_IF(animation != "off", "Unknown animation mode " << animation);
+    }
     
-    // Kích hoạt FlowMonitor
+    // Kích hoạt FlowMonitor (radio abstract không có gói tin)
     FlowMonitorHelper flowmon;
-    Ptr<FlowMonitor> monitor = flowmon.InstallAll();
+    Ptr<FlowMonitor> monitor;
+    if (!abstract) monitor = flowmon.InstallAll();
+    
+    if (cfg.profile) {
+        sampler.Register(Seconds(cfg.profileInterval), Seconds(cfg.profileInterval), Seconds(simTime),
+                         [] { SelfProfiler::Get().Sample(); });
+    }
     
+    auto runStart = std::chrono::steady_clock::now();
     std::cout << "Simulation Started..." << std::endl;
-    Simulator::Stop(Seconds(simTime));
+    SelfProfiler::Get().BeginRun();
+    Simulator::Stop(Seconds(simTime - now));
     Simulator::Run();
+    auto runEnd = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ueState.Size(); ++i) if (ueState[i].packets.hoOpen) CloseHoWindow(ueState[i]);
+    if (cfg.kpiInterval > 0) kpiStats.WriteInterval(simTime);   // khoảng cuối (tick tại simTime không chạy)
     
     // Xuất kết quả FlowMonitor
-    std::cout << "Processing FlowMonitor stats..." << std::endl;
-    monitor->CheckForLostPackets();
-    Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier>(flowmon.GetClassifier());
-    std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats();
-    
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin(); i != stats.end(); ++i) {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(i->first);
-        // Tính Packet Loss Ratio
-        double lossRate = 0.0;
-        if (i->second.txPackets > 0) lossRate = (double)i->second.lostPackets / (double)i->second.txPackets * 100.0;
+    uint64_t totalTxPkts = 0, totalLostPkts = 0;
+    if (monitor) {
+        std::cout << "Processing FlowMonitor stats..." << std::endl;
+        monitor->CheckForLostPackets();
+        Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier>(flowmon.GetClassifier());
+        std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats();
+        
+        for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin(); i != stats.end(); ++i) {
+            Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(i->first);
+            // Tính Packet Loss Ratio
+            double lossRate = 0.0;
+            if (i->second.txPackets > 0) lossRate = (double)i->second.lostPackets / (double)i->second.txPackets * 100.0;
+            totalTxPkts += i->second.txPackets; totalLostPkts += i->second.lostPackets;
         
-        flowStatsFile << i->first << "," << t.sourceAddress << "," << t.destinationAddress << ","
-                      << i->second.txPackets << "," << i->second.rxPackets << ","
-                      << i->second.lostPackets << "," << lossRate << ","
-                      << i->second.delaySum.GetSeconds() / (i->second.rxPackets+1) * 1000 << ","
-                      << i->second.jitterSum.GetSeconds() / (i->second.rxPackets > 1 ? i->second.rxPackets - 1 : 1) * 1000 << std::endl;
+            // Phân bố delay của flow (histogram của FlowMonitor); theo UE thì đã đo từng gói ở UePacketRx
+            const Histogram& delay = i->second.delayHistogram;
+            for (uint32_t b = 0; b < delay.GetNBins(); ++b) {
+                double ms = (delay.GetBinStart(b) + delay.GetBinWidth(b) / 2) * 1000.0;
+                kpiStats.RecordFlow(i->first, KPI_PACKET_DELAY, ms, delay.GetBinCount(b));
+            }
+        
+            flowStatsFile.Write({i->first, t.sourceAddress.Get(), t.destinationAddress.Get(),
+                                 i->second.txPackets, i->second.rxPackets, i->second.lostPackets, lossRate,
+                                 i->second.delaySum.GetSeconds() / (i->second.rxPackets+1) * 1000,
+                                 i->second.jitterSum.GetSeconds() / (i->second.rxPackets > 1 ? i->second.rxPackets - 1 : 1) * 1000});
+        }
     }
+    rateCalibration.Close();
 
-    // Close Files & Clean up
-    rsrpFile.close(); throughputFile.close(); mecOffloadFile.close(); cellIdFile.close(); 
-    uavPositionFile.close(); positionFile.close(); handoverFile.close(); handoverQualityFile.close(); sinrFile.close(); hoTraceFile.close();
-    flowStatsFile.close();
+    // Flush buffer còn lại, chờ writer thread ghi xong rồi mới đóng file
+    ForEachTraceStream([](auto& stream) { stream.Flush(); });
+    TraceWriter::Get().Stop();
+    ForEachTraceStream([](auto& stream) { stream.Close(); });
+    
+    // Tổng kết MEC theo từng UAV
+    std::ofstream mecUavFile("scenario1_final_mec_uav.csv");
+    mecUavFile << "CellId,Cores,ClockMHz,TasksServed,Utilisation,MeanQueueDelay,MaxQueueDelay,MaxQueueLength,EnergyJ\n";
+    for (const MecServer& srv : mecServers) {
+        mecUavFile << srv.m_cellId << "," << srv.m_cores << "," << srv.m_clockMHz << "," << srv.m_served << ","
+                   << srv.Utilisation(simTime) << "," << (srv.m_served ? srv.m_queueDelaySum / srv.m_served : 0.0) << ","
+                   << srv.m_queueDelayMax << "," << srv.m_maxQueue << "," << srv.m_energyJ << "\n";
+    }
+    mecUavFile.close();
+    
+    // Tổng kết gói downlink theo từng UE (từ bộ đếm PacketStats)
+    std::ofstream packetFile("scenario1_final_packet_stats.csv");
+    packetFile << "UE_ID,Received,Lost,LossRate,Reordered,LossBursts,MaxLossBurst,Handovers,MeanInterruption(ms),MaxInterruption(ms)\n";
+    uint64_t pktReceived = 0, pktLost = 0, pktReordered = 0;
+    for (uint32_t i = 0; i < ueState.Size(); ++i) {
+        const PacketStats& ps = ueState[i].packets;
+        uint64_t expected = ps.received + ps.lost;
+        packetFile << i + 1 << "," << ps.received << "," << ps.lost << "," << (expected ? (double)ps.lost / expected * 100.0 : 0.0) << ","
+                   << ps.reordered << "," << ps.lossBursts << "," << ps.maxLossBurst << "," << ps.handovers << ","
+                   << (ps.handovers ? ps.interruptionSum / ps.handovers : 0.0) << "," << ps.interruptionMax << "\n";
+        pktReceived += ps.received; pktLost += ps.lost; pktReordered += ps.reordered;
+    }
+    packetFile.close();
+    kpiStats.WriteSummary("scenario1_final_kpi_summary.csv");
     
     std::cout << "\n=== FINAL REPORT ===" << std::endl;
     std::cout << "HO Attempts: " << handoverStartCount << " | Success: " << handoverCount << std::endl;
+    std::vector<double> offloadedLatency, allLatency;
+    for (const OffloadTask& task : offloadTasks) {
+        allLatency.push_back(task.latency);
+        if (task.offloaded) offloadedLatency.push_back(task.latency);
+    }
+    std::cout << "MEC tasks: " << mecTasks.size() << " | offloaded " << offloadedLatency.size()
+              << " | lost " << mecTasksFailed << std::endl;
+    std::cout << "MEC latency (offloaded) p50/p95/p99: " << Percentile(offloadedLatency, 50) * 1000 << " / "
+              << Percentile(offloadedLatency, 95) * 1000 << " / " << Percentile(offloadedLatency, 99) * 1000 << " ms" << std::endl;
+    std::cout << "MEC latency (all)       p50/p95/p99: " << Percentile(allLatency, 50) * 1000 << " / "
+              << Percentile(allLatency, 95) * 1000 << " / " << Percentile(allLatency, 99) * 1000 << " ms" << std::endl;
+    // Thời gian task offload phải chờ container (0 nếu container đã sẵn ở cell)
+    std::vector<double> migrationWait;
+    for (const MecTask& task : mecTasks) if (task.uploaded >= 0 && task.arrived >= 0) migrationWait.push_back(task.migrationPenalty);
+    uint32_t waited = std::count_if(migrationWait.begin(), migrationWait.end(), [](double w) { return w > 0.0; });
+    migration.Report(std::cout);
+    offloadPolicyStats.Print(std::cout);
+    double ueEnergy = 0.0, uavEnergy = 0.0;
+    for (const OffloadTask& task : offloadTasks) ueEnergy += task.energy;
+    for (const MecServer& srv : mecServers) uavEnergy += srv.m_energyJ;
+    std::cout << "Energy: UE " << ueEnergy << " J (" << (offloadTasks.empty() ? 0.0 : ueEnergy / offloadTasks.size())
+              << " J per task) | UAV MEC " << uavEnergy << " J" << std::endl;
+    if (abstract) abstractRadio.Report(std::cout);
+    hoAnalytics.Report("scenario1_final_handover_pairs.csv", std::cout);
+    uavPlacement.Report(std::cout);
+    uavTraceFeeder.Report(std::cout);
+    ueTraceFeeder.Report(std::cout);
+    taskTrace.Report(std::cout);
+    ReportTraffic(std::cout, simTime);
+    cellCapacity.Close(std::cout);
+    lteLossCache.Print(std::cout, "LTE channel");
+    abstractLossCache.Print(std::cout, "abstract radio");
+    std::cout << "Downlink packets: received " << pktReceived << " | lost " << pktLost
+              << " | reordered " << pktReordered << std::endl;
+    kpiStats.Print(std::cout);
+    std::cout << "Migration wait: " << waited << "/" << migrationWait.size() << " tasks waited | p95/max "
+              << Percentile(migrationWait, 95) * 1000 << " / " << Percentile(migrationWait, 100) * 1000 << " ms" << std::endl;
     std::cout << "Stats Generated in: scenario1_final_flow_stats.csv, mec_offload.csv, etc." << std::endl;
+    std::cout << "Wall clock: setup " << std::chrono::duration<double>(runStart - wallStart).count()
+              << "s | run " << std::chrono::duration<double>(runEnd - runStart).count() << "s" << std::endl;
     
-    delete pAnim; 
+    RunKpis kpis;
+    kpis.handovers = handoverCount;
+    kpis.pingPongs = pingPongHandoverCount;
+    kpis.rlfs = hoAnalytics.Rlfs() + hoAnalytics.Failures();
+    kpis.tooEarly = hoAnalytics.Count(HO_TOO_EARLY);
+    kpis.tooLate = hoAnalytics.Count(HO_TOO_LATE);
+    kpis.wrongCell = hoAnalytics.Count(HO_WRONG_CELL);
+    std::vector<double> latencies;
+    for (const OffloadTask& task : offloadTasks) latencies.push_back(task.latency);
+    if (!latencies.empty()) kpis.mecLatencyMean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+    kpis.mecLatencyP95 = Percentile(latencies, 95.0);
+    if (totalTxPkts > 0) kpis.lossRate = (double)totalLostPkts / (double)totalTxPkts * 100.0;
+    if (!migrationWait.empty()) kpis.migrationWaitMean = std::accumulate(migrationWait.begin(), migrationWait.end(), 0.0) / migrationWait.size();
+    kpis.migratedMB = migration.MovedMB();
+    kpis.wastedPrecopies = migration.WastedPrecopies();
+    if (!offloadTasks.empty()) {
+        kpis.offloadRatio = (double)std::count_if(offloadTasks.begin(), offloadTasks.end(),
+                                                  [](const OffloadTask& t) { return t.offloaded; }) / offloadTasks.size();
+    }
+    kpis.events = Simulator::GetEventCount();
+    kpis.setupSec = std::chrono::duration<double>(runStart - wallStart).count();
+    kpis.runSec = std::chrono::duration<double>(runEnd - runStart).count();
+    kpis.throughputMean = kpiStats.GlobalMean(KPI_THROUGHPUT);
+    if (!offloadTasks.empty()) kpis.ueEnergyMean = ueEnergy / offloadTasks.size();
+    kpis.decisionNs = offloadPolicyStats.decisionNs.Mean();
+    
+    delete pAnim; pAnim = 0;
+    animRecorder.Close();
     Simulator::Destroy();
+    SelfProfiler::Get().SetPhases(std::chrono::duration<double>(runStart - wallStart).count(),
+                                  std::chrono::duration<double>(runEnd - runStart).count(),
+                                  std::chrono::duration<double>(std::chrono::steady_clock::now() - runEnd).count());
+    return kpis;
+}
+
+RunKpis RunScenario(const ScenarioConfig& cfg)
+{
+    auto wallStart = std::chrono::steady_clock::now();
+    ApplyRunConfig(cfg);
+    
+    std::cout << "SCENARIO: UAV-MEC Handover with Migration Penalty & FlowMonitor" << std::endl;
+    
+    OpenTraceFiles(cfg);
+    ScenarioNetwork net;
+    BuildNetwork(cfg, net);
+    return RunNetwork(cfg, net, wallStart);
+}
+
+// ==================== PARAMETER SWEEP ====================
+// Mỗi tổ hợp tham số x mỗi seed = một process con (fork) chạy trong thư mục riêng.
+// Process cha chỉ điều phối, không khởi tạo mô phỏng nào.
+struct SweepRun {
+    ScenarioConfig cfg;
+    std::string dir;
+    uint32_t combo;   // chỉ số tổ hợp tham số (không tính seed)
+};
+
+std::vector<double> ParseList(const std::string& text, double fallback) {
+    std::vector<double> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) if (!item.empty()) values.push_back(std::stod(item));
+    if (values.empty()) values.push_back(fallback);
+    return values;
+}
+
+std::vector<std::string> ParseNames(const std::string& text, const std::string& fallback) {
+    std::vector<std::string> names;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) if (!item.empty()) names.push_back(item);
+    if (names.empty()) names.push_back(fallback);
+    return names;
+}
+
+// t-Student hai phía 95%, bậc tự do 1..30; lớn hơn dùng xấp xỉ chuẩn
+double StudentT95(uint32_t dof) {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof == 0) return 0.0;
+    return dof <= 30 ? table[dof - 1] : 1.960;
+}
+
+void WriteMeanCi(std::ostream& os, const std::vector<double>& v) {
+    double mean = std::accumulate(v.begin(), v.end(), 0.0) / v.size();
+    double var = 0.0;
+    for (double x : v) var += (x - mean) * (x - mean);
+    double ci = v.size() > 1 ? StudentT95(v.size() - 1) * std::sqrt(var / (v.size() - 1)) / std::sqrt((double)v.size()) : 0.0;
+    os << "," << mean << "," << ci;
+}
+
+// Thay đổi tương đối (%) so với baseline; baseline 0 thì chỉ báo nếu hiện tại khác 0
+double RelativeChange(double current, double base) {
+    if (base == 0.0) return current == 0.0 ? 0.0 : 100.0;
+    return (current - base) / base * 100.0;
+}
+
+// Ngân sách worker chung cho mọi process của sweep, kiểu jobserver của make: socket chứa `jobs`
+// token, process nào đang mô phỏng (build + warm-up một batch, hoặc một run) giữ một token.
+// Process giữ token tự trả trước khi _exit; chết vì signal thì process cha trả hộ
+struct JobTokens {
+    int fd[2] = {-1, -1};
+
+    void Init(uint32_t jobs) {
+        NS_ABORT_MSG_IF(::socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0, "socketpair() failed");
+        for (uint32_t i = 0; i < jobs; ++i) Release();
+    }
+
+    // wait = false: trả về false ngay nếu chưa có token rảnh
+    bool Acquire(bool wait) const {
+        char c;
+        for (;;) {
+            ssize_t n = ::recv(fd[0], &c, 1, wait ? 0 : MSG_DONTWAIT);
+            if (n == 1) return true;
+            if (n < 0 && errno == EINTR) continue;
+            NS_ABORT_MSG_IF(n == 0 || wait || (errno != EAGAIN && errno != EWOULDBLOCK), "job token socket failed");
+            return false;
+        }
+    }
+
+    void Release() const {
+        char c = '+';
+        while (::send(fd[1], &c, 1, 0) != 1) NS_ABORT_MSG_IF(errno != EINTR, "job token socket failed");
+    }
+};
+
+// Fan-out: giữ tối đa `jobs` process con chạy đồng thời. Mỗi con chạy `body` trong thư mục riêng
+// của run, log riêng, rồi ghi kpi.csv cho process cha đọc. Có `tokens` thì mỗi con còn phải giữ
+// một token của ngân sách chung; chỉ chờ token khi không còn con nào để thu về (con chết vì signal
+// phải được waitpid thì token của nó mới quay lại)
+void ForkRuns(const std::vector<SweepRun>& runs, const std::vector<size_t>& order, uint32_t jobs,
+              const std::function<RunKpis(const SweepRun&)>& body, std::vector<bool>& failed,
+              const JobTokens* tokens = nullptr)
+{
+    std::map<pid_t, size_t> active;
+    size_t next = 0;
+    while (next < order.size() || !active.empty()) {
+        while (next < order.size() && active.size() < jobs && (!tokens || tokens->Acquire(active.empty()))) {
+            const SweepRun& run = runs[order[next]];
+            ::mkdir(run.dir.c_str(), 0755);
+            // kpi.csv của lần sweep trước cùng thư mục không được tính là kết quả của run này
+            std::remove((run.dir + "/kpi.csv").c_str());
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                // Process con: output vào thư mục riêng, log riêng
+                bool ok = ::chdir(run.dir.c_str()) == 0 && std::freopen("run.log", "w", stdout);
+                if (ok) {
+                    RunKpis k = body(run);
+                    if (run.cfg.profile) SelfProfiler::Get().Dump(std::cout, "");
+                    ok = WriteKpiFile("kpi.csv", k);
+                    std::fflush(stdout);
+                }
+                if (tokens) tokens->Release();
+                ::_exit(ok ? 0 : 1);
+            }
+            NS_ABORT_MSG_IF(pid < 0, "fork() failed");
+            active[pid] = order[next++];
+        }
+        int status = 0;
+        pid_t done = ::waitpid(-1, &status, 0);
+        if (done <= 0) continue;
+        auto it = active.find(done);
+        if (it == active.end()) continue;
+        if (tokens && !WIFEXITED(status)) tokens->Release();
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed[it->second] = true;
+            std::cout << "   [SWEEP] " << runs[it->second].dir << " FAILED" << std::endl;
+        } else {
+            std::cout << "   [SWEEP] " << runs[it->second].dir << " done" << std::endl;
+        }
+        active.erase(it);
+    }
+}
+
+// Tham số dùng khi dựng mạng (BuildNetwork): các run cùng key chia được một mạng đã warm-up.
+// Với radio lte, hysteresis / TTT nằm trong cấu hình đo đã gửi cho UE lúc attach nên thuộc key
+std::string NetworkKey(const ScenarioConfig& c) {
+    std::ostringstream key;
+    key << c.radio << "|" << c.seed << "|" << c.simTime << "|" << c.hysteresis << "|" << c.timeToTriggerMs << "|"
+        << c.pathlossExponent << "|" << c.txPower << "|" << c.pathlossCache << "|" << c.numUavs << "|" << c.numUes << "|"
+        << c.cellSpacing << "|" << c.uavAltitude << "|" << c.patrolRadius << "|" << c.patrolPeriod << "|"
+        << c.staticFraction << "|" << c.vehicularFraction << "|" << c.mec.x2RateMbps << "|" << c.mec.x2DelayMs << "|" << RlcBufferBytes(c);
+    return key.str();
+}
+
+// Warm start: mỗi nhóm run cùng NetworkKey do một process con dựng mạng và chạy warm-up tới
+// kWarmupTime một lần, rồi fork từng run từ trạng thái đó (copy-on-write). Worker chỉ áp tham số
+// sau warm-up (MEC, traffic, placement, cửa sổ phân tích HO) và substream RNG của seed mình;
+// thời gian dựng + warm-up chia đều cho các run của nhóm (SetupSec trong kpi.csv).
+// Tối đa `jobs` batch chạy song song; warm-up của batch và các run fork từ nó dùng chung một
+// ngân sách `jobs` token nên tổng số process đang mô phỏng không vượt `jobs`
+void RunWarmBatches(const std::vector<SweepRun>& runs, uint32_t jobs, const std::string& outDir, std::vector<bool>& failed)
+{
+    std::vector<std::pair<std::string, std::vector<size_t>>> batches;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        std::string key = NetworkKey(runs[i].cfg);
+        auto it = std::find_if(batches.begin(), batches.end(),
+                               [&key](const std::pair<std::string, std::vector<size_t>>& b) { return b.first == key; });
+        if (it == batches.end()) batches.push_back({key, {i}});
+        else it->second.push_back(i);
+    }
+    std::cout << "SWEEP warm start: " << batches.size() << " networks for " << runs.size() << " runs" << std::endl;
+
+    for (const auto& batch : batches) {
+        const ScenarioConfig& first = runs[batch.second[0]].cfg;
+        NS_ABORT_MSG_IF(first.radio != "lte", "Warm start needs radio=lte (the abstract radio has no attach phase to share)");
+        NS_ABORT_MSG_IF(!first.uavTrace.empty() || !first.ueTrace.empty() || !first.taskTrace.empty(),
+                        "Warm start does not support trace inputs: forked workers would share the trace file offsets");
+    }
+
+    JobTokens tokens;
+    tokens.Init(jobs);
+    // pid của batch -> (chỉ số batch, đầu đọc pipe báo "đã trả token warm-up")
+    std::map<pid_t, std::pair<size_t, int>> active;
+    size_t next = 0;
+    while (next < batches.size() || !active.empty()) {
+        while (next < batches.size() && active.size() < jobs) {
+            size_t b = next++;
+            const std::vector<size_t>& members = batches[b].second;
+            const ScenarioConfig& first = runs[members[0]].cfg;
+            // Batch chết trước khi fork run nào thì không được để lại kpi.csv cũ
+            for (size_t i : members) std::remove((runs[i].dir + "/kpi.csv").c_str());
+            int warmed[2];
+            NS_ABORT_MSG_IF(::pipe(warmed) != 0, "pipe() failed");
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                ::close(warmed[0]);
+                std::string log = outDir + "/warm_" + std::to_string(b) + ".log";
+                if (!std::freopen(log.c_str(), "w", stdout)) ::_exit(2);
+                tokens.Acquire(true);
+                auto wallStart = std::chrono::steady_clock::now();
+                ApplyRunConfig(first);
+                // Record của warm-up (attach, cell ID đầu) giữ trong RAM, mỗi run ghi vào file của mình
+                ForEachTraceStream([](auto& stream) { stream.Hold(); });
+                ScenarioNetwork net;
+                BuildNetwork(first, net);
+                Simulator::Stop(Seconds(kWarmupTime));
+                Simulator::Run();
+                double warmSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+                tokens.Release();
+                char c = '+';
+                if (::write(warmed[1], &c, 1) != 1) ::_exit(2);
+                ::close(warmed[1]);
+                double shared = warmSec / members.size();
+                std::cout << "WARM: built and warmed to " << kWarmupTime << " s in " << warmSec << " s | "
+                          << members.size() << " runs, " << shared << " s each" << std::endl;
+                std::fflush(stdout);
+                std::vector<bool> batchFailed(runs.size(), false);
+                ForkRuns(runs, members, members.size(), [&net, shared](const SweepRun& run) {
+                    auto armStart = std::chrono::steady_clock::now();
+                    ApplyRunConfig(run.cfg);
+                    ReseedNetwork(net, run.cfg.run);
+                    OpenTraceFiles(run.cfg);
+                    ForEachTraceStream([](auto& stream) { stream.DropHeld(); });
+                    RunKpis k = RunNetwork(run.cfg, net, armStart);
+                    k.setupSec += shared;
+                    return k;
+                }, batchFailed, &tokens);
+                std::fflush(stdout);
+                ::_exit(std::count(batchFailed.begin(), batchFailed.end(), true) ? 1 : 0);
+            }
+            NS_ABORT_MSG_IF(pid < 0, "fork() failed");
+            ::close(warmed[1]);
+            active[pid] = {b, warmed[0]};
+        }
+        int status = 0;
+        pid_t done = ::waitpid(-1, &status, 0);
+        if (done <= 0) continue;
+        auto it = active.find(done);
+        if (it == active.end()) continue;
+        size_t b = it->second.first;
+        // Batch chết giữa build / warm-up (chưa báo qua pipe) thì còn giữ token: trả hộ
+        char c;
+        if (!WIFEXITED(status) && ::read(it->second.second, &c, 1) != 1) tokens.Release();
+        ::close(it->second.second);
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        // kpi.csv cũ đã xóa trước khi fork, nên chỉ run chạy xong của batch này mới có file
+        for (size_t i : batches[b].second) failed[i] = !std::ifstream(runs[i].dir + "/kpi.csv");
+        std::cout << "   [SWEEP] warm batch " << b << " (" << batches[b].second.size() << " runs) "
+                  << (ok ? "done" : "had failures, see " + outDir + "/warm_" + std::to_string(b) + ".log") << std::endl;
+        active.erase(it);
+    }
+    ::close(tokens.fd[0]); ::close(tokens.fd[1]);
+}
+
+int RunSweep(const ScenarioConfig& base, const std::string& hystList, const std::string& tttList,
+             const std::string& expList, const std::string& txList, const std::string& migrationList,
+             const std::string& placementList, uint32_t seeds, uint32_t jobs, bool warmStart, const std::string& outDir)
+{
+    std::vector<SweepRun> runs;
+    uint32_t combo = 0;
+    // Placement là vòng ngoài cùng: mỗi mode một khối tổ hợp liên tiếp, cùng thứ tự bên trong
+    std::vector<std::string> placements = ParseNames(placementList, base.placement);
+    for (const std::string& place : placements)
+    for (const std::string& mig : ParseNames(migrationList, base.mec.migration))
+    for (double h : ParseList(hystList, base.hysteresis))
+    for (double ttt : ParseList(tttList, base.timeToTriggerMs))
+    for (double e : ParseList(expList, base.pathlossExponent))
+    for (double tx : ParseList(txList, base.txPower)) {
+        for (uint32_t r = 1; r <= seeds; ++r) {
+            SweepRun run;
+            run.cfg = base;
+            run.cfg.hysteresis = h; run.cfg.timeToTriggerMs = ttt; run.cfg.pathlossExponent = e; run.cfg.txPower = tx;
+            run.cfg.mec.migration = mig;
+            run.cfg.placement = place;
+            run.cfg.animation = "off";   // không ai xem animation của từng run trong sweep
+            run.cfg.run = r;
+            run.combo = combo;
+            run.dir = outDir + "/run_" + std::to_string(runs.size());
+            runs.push_back(run);
+        }
+        combo++;
+    }
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+    ::mkdir(outDir.c_str(), 0755);
+    std::cout << "SWEEP: " << combo << " configs x " << seeds << " seeds = " << runs.size()
+              << " runs on " << jobs << " workers" << std::endl;
+
+    std::vector<bool> failed(runs.size(), false);
+    if (warmStart) {
+        RunWarmBatches(runs, jobs, outDir, failed);
+    } else {
+        std::vector<size_t> order(runs.size());
+        std::iota(order.begin(), order.end(), 0);
+        ForkRuns(runs, order, jobs, [](const SweepRun& run) { return RunScenario(run.cfg); }, failed);
+    }
+
+    // Gom KPI của từng run
+    std::map<uint32_t, std::vector<RunKpis>> byCombo;
+    std::ofstream runsFile(outDir + "/sweep_runs.csv");
+    runsFile << "Run,Placement,Migration,Hysteresis,TimeToTrigger,Exponent,TxPower,SeedRun," << kKpiHeader << "\n";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (failed[i]) continue;
+        RunKpis k;
+        std::string line;
+        if (!ReadKpiFile(runs[i].dir + "/kpi.csv", k, line)) continue;
+        byCombo[runs[i].combo].push_back(k);
+        const ScenarioConfig& c = runs[i].cfg;
+        runsFile << i << "," << c.placement << "," << c.mec.migration << "," << c.hysteresis << "," << c.timeToTriggerMs << "," << c.pathlossExponent << ","
+                 << c.txPower << "," << c.run << "," << line << "\n";
+    }
+
+    // Bảng tổng hợp: mean và nửa độ rộng khoảng tin cậy 95% cho mỗi KPI
+    std::ofstream summary(outDir + "/sweep_summary.csv");
+    summary << "Placement,Migration,Hysteresis,TimeToTrigger,Exponent,TxPower,N,"
+            << "Handovers,Handovers_CI95,PingPongs,PingPongs_CI95,MecLatencyMean,MecLatencyMean_CI95,"
+            << "MecLatencyP95,MecLatencyP95_CI95,LossRate,LossRate_CI95,MigrationWaitMean,MigrationWaitMean_CI95,"
+            << "MigratedMB,MigratedMB_CI95,WastedPrecopies,WastedPrecopies_CI95,ThroughputMean,ThroughputMean_CI95,"
+            << "Rlfs,Rlfs_CI95,TooEarly,TooEarly_CI95,TooLate,TooLate_CI95,WrongCell,WrongCell_CI95\n";
+    for (const auto& entry : byCombo) {
+        const ScenarioConfig& c = runs[entry.first * seeds].cfg;
+        const std::vector<RunKpis>& ks = entry.second;
+        std::vector<double> ho, pp, mean, p95, loss, wait, moved, wasted, thpt, rlf, early, late, wrong;
+        for (const RunKpis& k : ks) {
+            ho.push_back(k.handovers); pp.push_back(k.pingPongs); mean.push_back(k.mecLatencyMean);
+            p95.push_back(k.mecLatencyP95); loss.push_back(k.lossRate);
+            wait.push_back(k.migrationWaitMean); moved.push_back(k.migratedMB); wasted.push_back(k.wastedPrecopies);
+            thpt.push_back(k.throughputMean);
+            rlf.push_back(k.rlfs); early.push_back(k.tooEarly); late.push_back(k.tooLate); wrong.push_back(k.wrongCell);
+        }
+        summary << c.placement << "," << c.mec.migration << "," << c.hysteresis << "," << c.timeToTriggerMs << "," << c.pathlossExponent << "," << c.txPower << "," << ks.size();
+        WriteMeanCi(summary, ho); WriteMeanCi(summary, pp); WriteMeanCi(summary, mean);
+        WriteMeanCi(summary, p95); WriteMeanCi(summary, loss);
+        WriteMeanCi(summary, wait); WriteMeanCi(summary, moved); WriteMeanCi(summary, wasted);
+        WriteMeanCi(summary, thpt);
+        WriteMeanCi(summary, rlf); WriteMeanCi(summary, early); WriteMeanCi(summary, late); WriteMeanCi(summary, wrong);
+        summary << "\n";
+    }
+
+    // Placement so với tuần tra cố định (placement=off) ở cùng tổ hợp tham số còn lại, mean qua các seed
+    auto off = std::find(placements.begin(), placements.end(), "off");
+    if (placements.size() > 1 && off != placements.end()) {
+        uint32_t block = combo / placements.size();
+        uint32_t offBlock = off - placements.begin();
+        std::ofstream gains(outDir + "/sweep_placement_gains.csv");
+        gains << "Placement,Migration,Hysteresis,TimeToTrigger,Exponent,TxPower,N,"
+              << "ThroughputMean,ThroughputGain%,HandoverRate,HandoverRateChange%,"
+              << "MecLatencyMean,MecLatencyMeanChange%,MecLatencyP95,MecLatencyP95Change%\n";
+        auto mean = [](const std::vector<RunKpis>& ks, std::function<double(const RunKpis&)> f) {
+            double sum = 0.0;
+            for (const RunKpis& k : ks) sum += f(k);
+            return ks.empty() ? 0.0 : sum / ks.size();
+        };
+        for (const auto& entry : byCombo) {
+            if (entry.first / block == offBlock) continue;
+            auto baseIt = byCombo.find(offBlock * block + entry.first % block);
+            if (baseIt == byCombo.end()) continue;
+            const ScenarioConfig& c = runs[entry.first * seeds].cfg;
+            // Handover / UE / phút, để so được giữa các kích thước topology
+            double ueMinutes = (c.numUavs > 0 ? c.numUes : 3) * c.simTime / 60.0;
+            auto thpt = [](const RunKpis& k) { return k.throughputMean; };
+            auto hoRate = [ueMinutes](const RunKpis& k) { return k.handovers / ueMinutes; };
+            auto latMean = [](const RunKpis& k) { return k.mecLatencyMean * 1000.0; };
+            auto latP95 = [](const RunKpis& k) { return k.mecLatencyP95 * 1000.0; };
+            gains << c.placement << "," << c.mec.migration << "," << c.hysteresis << "," << c.timeToTriggerMs << ","
+                  << c.pathlossExponent << "," << c.txPower << "," << entry.second.size();
+            for (const auto& f : std::vector<std::function<double(const RunKpis&)>>{thpt, hoRate, latMean, latP95}) {
+                double value = mean(entry.second, f);
+                gains << "," << value << "," << RelativeChange(value, mean(baseIt->second, f));
+            }
+            gains << "\n";
+        }
+        std::cout << "SWEEP placement gains vs fixed patrols: " << outDir << "/sweep_placement_gains.csv" << std::endl;
+    }
+    std::cout << "SWEEP finished: " << outDir << "/sweep_summary.csv" << std::endl;
+    return std::count(failed.begin(), failed.end(), true) == 0 ? 0 : 1;
+}
+
+// ==================== SCALING BENCHMARK ====================
+// Chạy kịch bản với seed cố định trên một thang kích thước (UAV x UE x simTime) và các mode.
+// Mỗi case là một process con chạy tuần tự (không song song) để wall time / RSS không bị nhiễu
+// bởi các case khác. Process cha lấy peak RSS của con qua wait4 và đếm byte output trong thư mục.
+struct BenchRow {
+    std::string size, mode;   // "UxExT" và chuỗi override "key=value;..." ("default" = không đổi gì)
+    double wallSec = 0.0, setupSec = 0.0, runSec = 0.0, eventsPerSec = 0.0, peakRssMB = 0.0;
+    uint64_t outputBytes = 0;
+    uint32_t handovers = 0, pingPongs = 0;
+    double offloadRatio = 0.0;
+};
+
+const char* kBenchHeader = "Size,Mode,WallSec,SetupSec,RunSec,EventsPerSec,PeakRssMB,OutputBytes,Handovers,PingPongs,OffloadRatio";
+
+void WriteBenchRow(std::ostream& os, const BenchRow& r) {
+    os << r.size << "," << r.mode << "," << r.wallSec << "," << r.setupSec << "," << r.runSec << ","
+       << r.eventsPerSec << "," << r.peakRssMB << "," << r.outputBytes << "," << r.handovers << ","
+       << r.pingPongs << "," << r.offloadRatio << "\n";
+}
+
+std::vector<BenchRow> ReadBenchFile(const std::string& path) {
+    std::vector<BenchRow> rows;
+    std::ifstream in(path);
+    NS_ABORT_MSG_IF(!in.is_open(), "Cannot open benchmark baseline " << path);
+    std::string line, item;
+    std::getline(in, line);   // header
+    while (std::getline(in, line)) {
+        std::vector<std::string> f;
+        std::stringstream ss(line);
+        while (std::getline(ss, item, ',')) f.push_back(item);
+        if (f.size() < 11) continue;
+        BenchRow r;
+        r.size = f[0]; r.mode = f[1];
+        r.wallSec = std::stod(f[2]); r.setupSec = std::stod(f[3]); r.runSec = std::stod(f[4]);
+        r.eventsPerSec = std::stod(f[5]); r.peakRssMB = std::stod(f[6]); r.outputBytes = std::stoull(f[7]);
+        r.handovers = std::stoul(f[8]); r.pingPongs = std::stoul(f[9]); r.offloadRatio = std::stod(f[10]);
+        rows.push_back(r);
+    }
+    return rows;
+}
+
+// Tổng byte các file thường trong thư mục (không đệ quy) — output trace của một run
+uint64_t DirectoryBytes(const std::string& dir) {
+    uint64_t total = 0;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) return 0;
+    while (struct dirent* e = ::readdir(d)) {
+        struct stat st;
+        std::string path = dir + "/" + e->d_name;
+        if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) total += st.st_size;
+    }
+    ::closedir(d);
+    return total;
+}
+
+int RunBench(const ScenarioConfig& base, const std::string& ladder, const std::string& modes,
+             const std::string& outDir, const std::string& baselineFile, double tolerance, double kpiTolerance)
+{
+    ::mkdir(outDir.c_str(), 0755);
+    std::vector<BenchRow> rows;
+    bool anyFailed = false;
+    uint32_t caseIndex = 0;   // đếm cả case lỗi: mỗi case một thư mục riêng
+    for (const std::string& size : ParseNames(ladder, "0x0x" + std::to_string((int)base.simTime)))
+    for (const std::string& mode : ParseNames(modes, "default")) {
+        ScenarioConfig cfg = base;
+        cfg.animation = "off";   // animation có mode riêng nếu muốn đo: "animation=positions"
+        cfg.run = 1;
+        uint32_t uavs = 0, ues = 0;
+        double simTime = 0.0;
+        NS_ABORT_MSG_IF(std::sscanf(size.c_str(), "%ux%ux%lf", &uavs, &ues, &simTime) != 3,
+                        "Bad benchmark size '" << size << "', expected UAVSxUESxSIMTIME");
+        cfg.numUavs = uavs;
+        cfg.numUes = uavs > 0 && ues == 0 ? uavs : ues;
+        cfg.simTime = simTime;
+        if (mode != "default") {
+            std::stringstream ss(mode);
+            std::string kv;
+            while (std::getline(ss, kv, ';')) {
+                size_t eq = kv.find('=');
+                NS_ABORT_MSG_IF(eq == std::string::npos || !ApplyScenarioKey(cfg, kv.substr(0, eq), kv.substr(eq + 1)),
+                                "Bad benchmark mode entry '" << kv << "'");
+            }
+        }
+        std::string dir = outDir + "/case_" + std::to_string(caseIndex++);
+        ::mkdir(dir.c_str(), 0755);
+        std::remove((dir + "/kpi.csv").c_str());
+        std::cout << "BENCH " << size << " [" << mode << "] ... " << std::flush;
+
+        auto wallStart = std::chrono::steady_clock::now();
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            if (::chdir(dir.c_str()) != 0) ::_exit(2);
+            if (!std::freopen("run.log", "w", stdout)) ::_exit(2);
+            bool ok = WriteKpiFile("kpi.csv", RunScenario(cfg));
+            std::fflush(stdout);
+            ::_exit(ok ? 0 : 1);
+        }
+        NS_ABORT_MSG_IF(pid < 0, "fork() failed");
+        int status = 0;
+        struct rusage usage;
+        ::wait4(pid, &status, 0, &usage);
+        BenchRow r;
+        r.size = size; r.mode = mode;
+        r.wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        r.peakRssMB = usage.ru_maxrss / 1024.0;   // Linux: KB
+        RunKpis k;
+        std::string line;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !ReadKpiFile(dir + "/kpi.csv", k, line)) {
+            std::cout << "FAILED (" << dir << "/run.log)" << std::endl;
+            anyFailed = true;
+            continue;
+        }
+        r.setupSec = k.setupSec; r.runSec = k.runSec;
+        r.eventsPerSec = k.runSec > 0 ? k.events / k.runSec : 0.0;
+        r.outputBytes = DirectoryBytes(dir);
+        r.handovers = k.handovers; r.pingPongs = k.pingPongs; r.offloadRatio = k.offloadRatio;
+        rows.push_back(r);
+        std::cout << std::fixed << std::setprecision(2) << r.wallSec << " s | " << std::setprecision(0)
+                  << r.eventsPerSec << " ev/s | " << std::setprecision(1) << r.peakRssMB << " MB | "
+                  << r.outputBytes / 1024 << " KB out | HO " << r.handovers << std::endl;
+    }
+
+    std::ofstream benchFile(outDir + "/bench.csv");
+    benchFile << kBenchHeader << "\n";
+    for (const BenchRow& r : rows) WriteBenchRow(benchFile, r);
+    std::cout << "BENCH results: " << outDir << "/bench.csv" << std::endl;
+    if (baselineFile.empty()) return anyFailed ? 1 : 0;
+
+    // So với baseline: cùng (Size, Mode). Chậm hơn / tốn bộ nhớ / output lớn hơn quá `tolerance`
+    // (tương đối) và KPI lệch quá `kpiTolerance` (tương đối, 0 = phải trùng) đều bị gắn cờ.
+    std::vector<BenchRow> baseline = ReadBenchFile(baselineFile);
+    std::ofstream cmpFile(outDir + "/bench_compare.csv");
+    cmpFile << "Size,Mode,WallChange,EventsPerSecChange,PeakRssChange,OutputBytesChange,"
+            << "Handovers,BaseHandovers,PingPongs,BasePingPongs,OffloadRatio,BaseOffloadRatio,Status\n";
+    uint32_t flagged = 0;
+    for (const BenchRow& r : rows) {
+        auto it = std::find_if(baseline.begin(), baseline.end(),
+                               [&r](const BenchRow& b) { return b.size == r.size && b.mode == r.mode; });
+        if (it == baseline.end()) {
+            cmpFile << r.size << "," << r.mode << ",,,,,,,,,,,NEW\n";
+            continue;
+        }
+        const BenchRow& b = *it;
+        double wall = RelativeChange(r.wallSec, b.wallSec), eps = RelativeChange(r.eventsPerSec, b.eventsPerSec);
+        double rss = RelativeChange(r.peakRssMB, b.peakRssMB), out = RelativeChange(r.outputBytes, b.outputBytes);
+        std::string status;
+        auto flag = [&status](const char* what) { status += status.empty() ? what : std::string("|") + what; };
+        if (wall > tolerance * 100.0 || eps < -tolerance * 100.0) flag("SLOWER");
+        if (rss > tolerance * 100.0) flag("MEMORY");
+        if (out > tolerance * 100.0) flag("OUTPUT");
+        if (std::fabs(RelativeChange(r.handovers, b.handovers)) > kpiTolerance * 100.0 ||
+            std::fabs(RelativeChange(r.pingPongs, b.pingPongs)) > kpiTolerance * 100.0 ||
+            std::fabs(RelativeChange(r.offloadRatio, b.offloadRatio)) > kpiTolerance * 100.0 + 1e-9) flag("KPI-DRIFT");
+        if (status.empty()) status = "OK";
+        else {
+            flagged++;
+            std::cout << "   [BENCH] " << r.size << " [" << r.mode << "]: " << status << std::setprecision(1)
+                      << " (wall " << wall << "%, ev/s " << eps << "%, rss " << rss << "%, HO "
+                      << b.handovers << "->" << r.handovers << ", PP " << b.pingPongs << "->" << r.pingPongs
+                      << ", offload " << b.offloadRatio << "->" << r.offloadRatio << ")" << std::endl;
+        }
+        cmpFile << r.size << "," << r.mode << "," << wall << "," << eps << "," << rss << "," << out << ","
+                << r.handovers << "," << b.handovers << "," << r.pingPongs << "," << b.pingPongs << ","
+                << r.offloadRatio << "," << b.offloadRatio << "," << status << "\n";
+    }
+    std::cout << "BENCH compare: " << flagged << "/" << rows.size() << " cases flagged -> "
+              << outDir << "/bench_compare.csv" << std::endl;
+    return anyFailed || flagged > 0 ? 1 : 0;
+}
+
+// ==================== MICROBENCHMARK ====================
+// So sánh chi phí truy cập state trên đường nóng của callback: các std::map theo IMSI
+// (cách cũ) với UeStateTable. Mỗi "callback" mô phỏng đúng các thao tác state của
+// ReportRsrp/RecvMeasurementReport (tra UE), NotifyHandoverEndOkUe và CalculateThroughput.
+void RunStateMicrobench(uint32_t numUes, uint64_t iterations) {
+    std::vector<uint64_t> imsis(iterations);
+    uint64_t x = 88172645463325252ULL; // xorshift, không phụ thuộc RNG của ns-3
+    for (uint64_t& imsi : imsis) { x ^= x << 13; x ^= x >> 7; x ^= x << 17; imsi = 1 + x % numUes; }
+    volatile double sink = 0.0;
+    auto nsPerOp = [iterations](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+        return std::chrono::duration<double, std::nano>(b - a).count() / iterations;
+    };
+
+    // --- Cách cũ: nhiều std::map, operator[] ---
+    std::map<uint32_t, uint64_t> rxMap;
+    std::map<uint32_t, double> thptMap;
+    std::map<uint32_t, uint16_t> cellMap;
+    std::map<uint64_t, std::deque<uint16_t>> historyMap;
+    std::map<uint64_t, HandoverEvent> eventMap;
+    for (uint32_t i = 1; i <= numUes; ++i) { rxMap[i] = 0; thptMap[i] = 0; cellMap[i] = 1; eventMap[i] = HandoverEvent(); }
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) sink = sink + cellMap[imsi];
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) {
+        cellMap[imsi] = imsi % 7;
+        if (historyMap[imsi].size() >= 2) sink = sink + historyMap[imsi].back();
+        historyMap[imsi].push_back(imsi % 7);
+        if (historyMap[imsi].size() > 3) historyMap[imsi].pop_front();
+        if (eventMap.find(imsi) != eventMap.end()) sink = sink + eventMap[imsi].throughputBefore - thptMap[imsi];
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) {
+        if (rxMap.find(imsi) == rxMap.end()) rxMap[imsi] = 0;
+        uint64_t rx = rxMap[imsi] + 1472;
+        thptMap[imsi] = (rx - rxMap[imsi]) * 8.0 / 1e6 / 0.1;
+        rxMap[imsi] = rx;
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    // --- UeStateTable ---
+    UeStateTable table;
+    table.Build(numUes);
+    for (uint32_t i = 0; i < numUes; ++i) {
+        table.BindImsi(i, i + 1);
+        // Cùng thao tác với eventMap ở trên: UE nào cũng đã có một HandoverEvent
+        UeState* ue = table.FindByImsi(i + 1);
+        ue->lastHandover = HandoverEvent();
+        ue->hasHandoverEvent = true;
+    }
+    auto t4 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) sink = sink + table.FindByImsi(imsi)->currentCell;
+    auto t5 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) {
+        UeState* ue = table.FindByImsi(imsi);
+        ue->currentCell = imsi % 7;
+        HandoverTracker& t = ue->hoTracker;
+        if (IsPingPongHandover(t, t.lastTarget, imsi % 7, 0.0, 1.0)) sink = sink + 1;
+        t.lastSource = t.lastTarget; t.lastTarget = imsi % 7;
+        if (ue->hasHandoverEvent) sink = sink + ue->lastHandover.throughputBefore - ue->lastThroughput;
+    }
+    auto t6 = std::chrono::steady_clock::now();
+    for (uint64_t imsi : imsis) {
+        UeState* ue = table.FindByImsi(imsi);
+        uint64_t rx = ue->totalRxBytes + 1472;
+        ue->lastThroughput = (rx - ue->totalRxBytes) * 8.0 / 1e6 / 0.1;
+        ue->totalRxBytes = rx;
+    }
+    auto t7 = std::chrono::steady_clock::now();
+
+    std::cout << "MICROBENCH: " << numUes << " UEs, " << iterations << " callbacks per path (ns/callback)" << std::endl;
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  Path                 std::map   UeStateTable" << std::endl;
+    std::cout << "  UE lookup (RSRP)     " << std::setw(8) << nsPerOp(t0, t1) << "   " << std::setw(12) << nsPerOp(t4, t5) << std::endl;
+    std::cout << "  HandoverEndOk        " << std::setw(8) << nsPerOp(t1, t2) << "   " << std::setw(12) << nsPerOp(t5, t6) << std::endl;
+    std::cout << "  CalculateThroughput  " << std::setw(8) << nsPerOp(t2, t3) << "   " << std::setw(12) << nsPerOp(t6, t7) << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+// ==================== MAIN ====================
+int main(int argc, char *argv[])
+{
+    ScenarioConfig cfg;
+    bool sweep = false;
+    bool microbench = false;
+    std::string scenarioFile;
+    std::string sweepHysteresis, sweepTtt, sweepExponent, sweepTxPower, sweepMigration, sweepPlacement, sweepDir = "sweep_results";
+    uint32_t seeds = 1, jobs = 0;
+    bool sweepWarmStart = false;
+    bool bench = false;
+    std::string benchLadder = "0x0x30,4x40x30,9x90x30,16x160x30", benchModes = "default", benchDir = "bench_results", benchBaseline;
+    double benchTolerance = 0.2, benchKpiTolerance = 0.0;
+    CommandLine cmd;
+    cmd.AddValue("simTime", "Simulation time", cfg.simTime);
+    cmd.AddValue("hysteresis", "A3-RSRP handover hysteresis (dB)", cfg.hysteresis);
+    cmd.AddValue("timeToTrigger", "A3-RSRP TimeToTrigger (ms)", cfg.timeToTriggerMs);
+    cmd.AddValue("exponent", "Log-distance path loss exponent", cfg.pathlossExponent);
+    cmd.AddValue("txPower", "UAV eNB TxPower (dBm)", cfg.txPower);
+    cmd.AddValue("run", "RNG run number", cfg.run);
+    cmd.AddValue("traceFormat", "Trace output format: csv | bin (binary columnar)", cfg.traceFormat);
+    cmd.AddValue("traceBatch", "Records buffered per trace file before a write", cfg.traceBatch);
+    cmd.AddValue("traceAsync", "Write trace batches on a background thread", cfg.traceAsync);
+    cmd.AddValue("animation", "Animation output: off | positions (compact keyframes) | full (NetAnim XML)", cfg.animation);
+    cmd.AddValue("animInterval", "Positions animation: seconds between keyframes", cfg.animInterval);
+    cmd.AddValue("animMinMove", "Positions animation: skip nodes that moved less than this (m)", cfg.animMinMove);
+    cmd.AddValue("animGzip", "Positions animation: stream through gzip", cfg.animGzip);
+    cmd.AddValue("profile", "Profile callbacks, event rate and memory; breakdown written at the end", cfg.profile);
+    cmd.AddValue("profileInterval", "Profiler timeline sample period (simulated s)", cfg.profileInterval);
+    cmd.AddValue("rawTraces", "Also write every RSRP/SINR/throughput/position sample (needed by combined_charts.py)", cfg.rawTraces);
+    cmd.AddValue("kpiInterval", "Write global and per-cell KPI histograms every N seconds (0 = end only)", cfg.kpiInterval);
+    cmd.AddValue("radio", "Radio engine: lte (full LTE/EPC stack) | abstract (SINR lookup, orders of magnitude faster)", cfg.radio);
+    cmd.AddValue("radioTable", "Abstract radio: SINR -> throughput CSV (empty = built-in per-cell capacity)", cfg.radioTable);
+    cmd.AddValue("radioTableOut", "LTE radio: write a calibrated SINR -> throughput table for the abstract radio", cfg.radioTableOut);
+    cmd.AddValue("pathlossCache", "Reuse path loss until a UAV/UE moves more than this (m, 0 = off)", cfg.pathlossCache);
+    cmd.AddValue("rlcBuffer", "RLC UM transmit buffer per bearer (bytes, 0 = ns-3 default, raised only for MEC bursts)", cfg.rlcBufferBytes);
+    cmd.AddValue("pingPongWindow", "A handover back to the previous cell within this time is a ping-pong (s)", cfg.pingPongWindow);
+    cmd.AddValue("hoFailureWindow", "An RLF within this time after a handover is too-early/wrong-cell (s)", cfg.hoFailureWindow);
+    cmd.AddValue("scenario", "Scenario file (key = value lines, overrides command-line values)", scenarioFile);
+    cmd.AddValue("numUavs", "Generated topology: number of UAV eNBs (0 = original 3-UAV scenario)", cfg.numUavs);
+    cmd.AddValue("numUes", "Generated topology: number of UEs", cfg.numUes);
+    cmd.AddValue("cellSpacing", "Generated topology: distance between UAV patrol centres (m)", cfg.cellSpacing);
+    cmd.AddValue("staticFraction", "Generated topology: fraction of static UEs", cfg.staticFraction);
+    cmd.AddValue("vehicularFraction", "Generated topology: fraction of vehicular UEs", cfg.vehicularFraction);
+    cmd.AddValue("uavTrace", "Replay UAV mobility from an ns-2 setdest or Time,NodeId,X,Y[,Z] CSV trace", cfg.uavTrace);
+    cmd.AddValue("ueTrace", "Replay UE mobility from an ns-2 setdest or Time,NodeId,X,Y[,Z] CSV trace", cfg.ueTrace);
+    cmd.AddValue("taskTrace", "Replay MEC task arrivals from a Time,NodeId CSV trace", cfg.taskTrace);
+    cmd.AddValue("traceHorizon", "Mobility traces: seconds of trace read ahead of the simulation clock", cfg.traceHorizon);
+    cmd.AddValue("placement", "UAV placement: off (fixed patrols) | greedy (reposition UAVs towards the UEs)", cfg.placement);
+    cmd.AddValue("placementInterval", "Placement: seconds between repositioning decisions", cfg.placementInterval);
+    cmd.AddValue("placementJobs", "Placement: threads scoring candidate positions (0 = all cores)", cfg.placementJobs);
+    cmd.AddValue("uavSpeed", "Placement: UAV flight speed (m/s)", cfg.uavSpeed);
+    cmd.AddValue("uavMinAltitude", "Placement: lowest UAV altitude (m)", cfg.uavMinAltitude);
+    cmd.AddValue("uavMaxAltitude", "Placement: highest UAV altitude (m)", cfg.uavMaxAltitude);
+    cmd.AddValue("microbench", "Benchmark per-callback UE state access and exit", microbench);
+    cmd.AddValue("mecCores", "CPU cores of each UAV MEC server", cfg.mec.cores);
+    cmd.AddValue("mecClock", "Clock of each UAV MEC core (Mcycles/s)", cfg.mec.clockMHz);
+    cmd.AddValue("mecDiscipline", "UAV MEC queue discipline: fifo | edf | priority", cfg.mec.discipline);
+    cmd.AddValue("mecInputBytes", "Task input uploaded over LTE (bytes)", cfg.mec.inputBytes);
+    cmd.AddValue("mecOutputBytes", "Task result downloaded over LTE (bytes)", cfg.mec.outputBytes);
+    cmd.AddValue("mecMcycles", "Task computation (Mcycles)", cfg.mec.mcycles);
+    cmd.AddValue("localClock", "UE local CPU clock (Mcycles/s)", cfg.mec.localClockMHz);
+    cmd.AddValue("mecInterval", "Mean time between tasks of one UE (s)", cfg.mec.interval);
+    cmd.AddValue("mecArrival", "Task arrivals: periodic | poisson", cfg.mec.arrival);
+    cmd.AddValue("mecDeadline", "Task deadline after creation (s)", cfg.mec.deadline);
+    cmd.AddValue("mecTimeout", "Offloaded task counts as lost without a result after this (s)", cfg.mec.timeout);
+    cmd.AddValue("mecPriorityClasses", "Priority discipline: UE classes, priority = (UE_ID - 1) % classes", cfg.mec.priorityClasses);
+    cmd.AddValue("offloadPolicy", "Offload policy: threshold | queue (queue-aware, default) | partial", cfg.mec.policy);
+    cmd.AddValue("throughputPredictor", "Upload throughput predictor: last | ewma | regression", cfg.mec.predictor);
+    cmd.AddValue("offloadThreshold", "Threshold policy: offload when predicted throughput >= this (Mb/s)", cfg.mec.thresholdMbps);
+    cmd.AddValue("energyWeight", "Weight of UE energy vs latency in the offload cost (0..1)", cfg.mec.energyWeight);
+    cmd.AddValue("predictorWindow", "Throughput samples (100 ms) used by ewma / regression (max 32)", cfg.mec.predictorWindow);
+    cmd.AddValue("ewmaAlpha", "EWMA predictor smoothing factor", cfg.mec.ewmaAlpha);
+    cmd.AddValue("ueKappa", "UE CPU energy coefficient (J per cycle per Hz^2)", cfg.mec.ueKappa);
+    cmd.AddValue("uavKappa", "UAV MEC CPU energy coefficient (J per cycle per Hz^2)", cfg.mec.uavKappa);
+    cmd.AddValue("ueTxPowerW", "UE power draw while uploading task input (W)", cfg.mec.ueTxPowerW);
+    cmd.AddValue("ueRxPowerW", "UE power draw while receiving task output (W)", cfg.mec.ueRxPowerW);
+    cmd.AddValue("traffic", "Downlink traffic profile: cbr|fullbuffer|onoff|poisson|adaptive", cfg.traffic.profile);
+    cmd.AddValue("staticTraffic", "Traffic profile for static UEs (empty = traffic)", cfg.traffic.staticProfile);
+    cmd.AddValue("vehicularTraffic", "Traffic profile for vehicular UEs (empty = traffic)", cfg.traffic.vehicularProfile);
+    cmd.AddValue("pedestrianTraffic", "Traffic profile for pedestrian UEs (empty = traffic)", cfg.traffic.pedestrianProfile);
+    cmd.AddValue("trafficRate", "cbr/onoff downlink rate per UE (Mb/s)", cfg.traffic.rateMbps);
+    cmd.AddValue("onTime", "onoff: mean on period (s)", cfg.traffic.onTime);
+    cmd.AddValue("offTime", "onoff: mean off period (s)", cfg.traffic.offTime);
+    cmd.AddValue("burstBytes", "poisson: bytes per burst", cfg.traffic.burstBytes);
+    cmd.AddValue("burstInterval", "poisson: mean time between bursts (s)", cfg.traffic.burstInterval);
+    cmd.AddValue("rampStep", "adaptive: rate increment per ramp interval (Mb/s)", cfg.traffic.rampStepMbps);
+    cmd.AddValue("rampInterval", "adaptive: time between rate adjustments (s)", cfg.traffic.rampInterval);
+    cmd.AddValue("lossThreshold", "Loss ratio that stops the adaptive ramp and bounds sustainable cell load", cfg.traffic.lossThreshold);
+    cmd.AddValue("ulRate", "Uplink cbr rate per UE (Mb/s, 0 = off)", cfg.traffic.ulRateMbps);
+    cmd.AddValue("capacityInterval", "Time between per-cell capacity samples (s)", cfg.traffic.capacityInterval);
+    cmd.AddValue("migration", "Service migration: flat | reactive | proactive", cfg.mec.migration);
+    cmd.AddValue("migrationStateBytes", "Container state moved on migration (bytes)", cfg.mec.stateBytes);
+    cmd.AddValue("migrationDirtyFraction", "Fraction of state re-sent after a pre-copy", cfg.mec.dirtyFraction);
+    cmd.AddValue("precopyMargin", "Pre-copy when neighbour RSRP is within this margin of serving and rising (dB)", cfg.mec.precopyMarginDb);
+    cmd.AddValue("x2Rate", "X2 link data rate between UAVs (Mb/s)", cfg.mec.x2RateMbps);
+    cmd.AddValue("x2Delay", "X2 link delay (ms)", cfg.mec.x2DelayMs);
+    cmd.AddValue("sweep", "Run a parameter sweep instead of a single run", sweep);
+    cmd.AddValue("sweepHysteresis", "Comma-separated hysteresis values (dB)", sweepHysteresis);
+    cmd.AddValue("sweepTtt", "Comma-separated TimeToTrigger values (ms)", sweepTtt);
+    cmd.AddValue("sweepExponent", "Comma-separated path loss exponents", sweepExponent);
+    cmd.AddValue("sweepTxPower", "Comma-separated TxPower values (dBm)", sweepTxPower);
+    cmd.AddValue("sweepMigration", "Comma-separated migration modes (e.g. reactive,proactive)", sweepMigration);
+    cmd.AddValue("sweepPlacement", "Comma-separated placement modes (e.g. off,greedy; gains vs off are tabulated)", sweepPlacement);
+    cmd.AddValue("seeds", "Replications (RNG runs 1..N) per configuration", seeds);
+    cmd.AddValue("jobs", "Parallel worker processes (0 = all cores)", jobs);
+    cmd.AddValue("sweepDir", "Output directory of the sweep", sweepDir);
+    cmd.AddValue("sweepWarmStart", "Build and warm each distinct network once, then fork its runs from the warmed state", sweepWarmStart);
+    cmd.AddValue("bench", "Run the scaling benchmark ladder instead of a single run", bench);
+    cmd.AddValue("benchLadder", "Comma-separated sizes UAVSxUESxSIMTIME (0 UAVs = original scenario)", benchLadder);
+    cmd.AddValue("benchModes", "Comma-separated modes, each 'default' or 'key=value;key=value'", benchModes);
+    cmd.AddValue("benchDir", "Output directory of the benchmark", benchDir);
+    cmd.AddValue("benchBaseline", "bench.csv of an earlier run to compare against", benchBaseline);
+    cmd.AddValue("benchTolerance", "Relative slowdown / memory / output growth flagged as regression", benchTolerance);
+    cmd.AddValue("benchKpiTolerance", "Relative KPI drift flagged (0 = KPIs must match exactly)", benchKpiTolerance);
+    cmd.Parse(argc, argv);
+    if (!scenarioFile.empty()) LoadScenarioFile(scenarioFile, cfg);
+    if (cfg.numUavs > 0 && cfg.numUes == 0) cfg.numUes = cfg.numUavs;
+    NS_ABORT_MSG_IF(cfg.mec.ueKappa <= 0.0, "ueKappa must be > 0");
+    
+    if (microbench) { RunStateMicrobench(cfg.numUes > 0 ? cfg.numUes : 1000, 2000000); return 0; }
+    if (bench) return RunBench(cfg, benchLadder, benchModes, benchDir, benchBaseline, benchTolerance, benchKpiTolerance);
+    if (sweep) return RunSweep(cfg, sweepHysteresis, sweepTtt, sweepExponent, sweepTxPower, sweepMigration, sweepPlacement, std::max(1u, seeds), jobs, sweepWarmStart, sweepDir);
+    RunScenario(cfg);
+    if (cfg.profile) SelfProfiler::Get().Dump(std::cout, "scenario1_final_");
     return 0;
 }